@@ -0,0 +1,1186 @@
+/*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* dao - runs a Daoyu program through libdao.
+*
+*	dao <file> [-flags] [--checkpoint-every steps] [--checkpoint-file snapshot]
+*	dao --resume <snapshot> [-flags] [--checkpoint-every steps]
+*	dao <file> --freeze <image> [-flags]
+*
+*	dao --serve <socket> [--quantum steps] [-flags]
+*
+* A .dao file is compiled in memory and run, anything else is run as compiled code, and -
+* reads the program from stdin. Flags are those of daox; -x reads hex source instead.
+* --checkpoint-every writes a snapshot every so many steps, to the --checkpoint-file or to
+* the program's name with .snap added, and --resume carries on from one, saving back to it.
+* --freeze runs a program up to its first INPUT and saves it there as an image, and --resume
+* starts later runs from the image, skipping whatever setup came before that INPUT.
+* --serve runs jobs sent over a UNIX socket, as described at serve().
+*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE									/* accept4() and pipe2() */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dao.h"
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+static unsigned char* slurp(FILE* file, size_t* count)
+{
+	size_t alloc = 64 * 1024, got;
+	unsigned char* bytes = malloc(alloc);
+	*count = 0;
+	while (bytes != NULL && (got = fread(bytes + *count, 1, alloc - *count, file)) > 0)
+		if ((*count += got) == alloc)
+		{
+			unsigned char* grown = realloc(bytes, alloc *= 2);
+			if (grown == NULL)
+				free(bytes);
+			bytes = grown;
+		}
+	return bytes;
+}
+
+#if defined(__linux__)
+/*
+* dao --serve <socket> [--quantum steps] [-flags] runs jobs sent over a UNIX socket on one
+* worker per core. Each worker runs a quantum of steps of a job, then puts it back at the end
+* of its queue, so a long job shares the worker with short ones instead of holding it; a
+* worker with nothing queued takes jobs from the back of the others' queues. A job at an INPUT
+* whose bytes have not come is set aside until they do, and so is a job whose output is piling
+* up unread until its client takes some. Every socket is read by one epoll
+* loop on the main thread, so a session waiting on its user costs no thread. Compiled images
+* of the programs seen are kept in SERVE_SLOTS slots, and VMs are kept for later jobs, so a
+* job costs a copy of its image and its steps.
+*
+* A connection sends any number of jobs, one after another. Numbers are big-endian. A job is
+*
+*	1	kind		'B': the program follows, 'F': the name of a program file follows
+*	1	format		DAO_SOURCE, DAO_HEX or DAO_COMPILED
+*	4	length		bytes of program or name
+*	4	input		bytes of INPUT, or SERVE_STREAM
+*	8	budget		most steps to run, 0 for no limit
+*	...	program or name, then INPUT
+*
+* The job starts once its program is in, and INPUT it reads ahead of its bytes waits for them.
+* With SERVE_STREAM for input, INPUT comes as it is typed, in frames of a 4 byte length and
+* that many bytes, up to an empty frame that ends it; a job ended early still takes the rest
+* of its input before the next job is read. The reply is frames of one type byte and a 4 byte
+* length: 'O' frames carry READS output as it is flushed, and a last 'X' frame carries the 4
+* byte status of dao_run(), DAO_ERROR if the program could not be loaded. Ahead of 'X', an 'S'
+* frame of six 8 byte numbers tells how the job was scheduled: quanta run, steps taken,
+* nanoseconds spent waiting in queues, the longest of those waits, nanoseconds running, and
+* nanoseconds from its arrival to its end.
+*/
+#define SERVE_SLOTS		1024					/* Compiled images kept, one per slot */
+#define SERVE_THREADS	64						/* Most workers */
+#define SERVE_HEADER	18						/* Bytes ahead of a job's program */
+#define SERVE_QUANTUM	100000					/* Steps a job runs before the next one's turn */
+#define SERVE_STREAM	0xFFFFFFFFUL			/* An input length: INPUT comes in frames */
+#define SERVE_PENDING	(1024 * 1024)			/* Bytes of INPUT held before the client is left to wait */
+#define SERVE_UNSENT	(1024 * 1024)			/* Bytes of output held before the job is left to wait */
+#define SERVE_READ		(64 * 1024)				/* Bytes read from a socket at a time */
+#define SERVE_EVENTS	256						/* Events taken from epoll at a time */
+
+#define CONN_HEADER		0						/* Reading a job's header */
+#define CONN_PROGRAM	1						/* Reading its program or name */
+#define CONN_INPUT		2						/* Reading its INPUT as it runs */
+#define CONN_FRAME		3						/* Reading the length of a frame of INPUT */
+#define CONN_FRAME_DATA	4						/* Reading a frame of INPUT */
+#define CONN_RUNNING	5						/* Its INPUT is all in */
+
+typedef struct IMAGE
+{
+	unsigned long long	key;					/* HASH OF WHAT MADE IT */
+	unsigned char*	made;						/* WHAT    MADE IT      */
+	size_t			length;						/* BYTES   OF THAT      */
+	unsigned char*	code;						/* COMPILED   CODE      */
+	size_t			size;						/* BYTES   OF CODE      */
+	unsigned int	refs;						/* SLOT AND JOBS USING  */
+} Image;
+
+typedef struct CONNECTION Connection;
+
+typedef struct TASK
+{
+	Dao_vm*			vm;							/* LOADED  PROGRAM      */
+	Image*			image;						/* WHAT    IT LOADED    */
+	Connection*		conn;						/* WHERE   IT CAME FROM */
+	unsigned long long	budget;					/* MOST    STEPS, 0 ANY */
+	unsigned long long	steps;					/* STEPS   TAKEN        */
+	unsigned long long	quanta;					/* TURNS   RUN          */
+	long long		submitted;					/* TIME    IT ARRIVED   */
+	long long		queued;						/* TIME    LAST QUEUED  */
+	long long		waited;						/* TIME    IN QUEUES    */
+	long long		waited_max;					/* LONGEST    WAIT      */
+	long long		ran;						/* TIME    RUNNING      */
+	int				status;						/* DAO_RUN()  RESULT    */
+} Task;
+
+struct CONNECTION
+{
+	int				fd;							/* CLIENT     SOCKET    */
+	int				dead;						/* WRITE   FAILED, LOCKED */
+	int				hangup;						/* CLIENT  CLOSED, LOCKED */
+	int				busy;						/* TASK    IS OUT       */
+	int				state;						/* WHAT    COMES NEXT   */
+	unsigned char	header[SERVE_HEADER];		/* JOB'S   HEADER       */
+	unsigned char	frame[4];					/* INPUT   FRAME LENGTH */
+	size_t			have;						/* BYTES   OF THIS PART */
+	size_t			left;						/* BYTES   STILL TO COME*/
+	unsigned char*	program;					/* PROGRAM OR NAME      */
+	size_t			program_alloc;				/* BYTES   ALLOCATED    */
+	unsigned char*	stash;						/* READ    PAST THE JOB */
+	size_t			stash_size;					/* BYTES   OF STASH     */
+	pthread_mutex_t	lock;						/* GUARDS  WHAT FOLLOWS */
+	unsigned char*	input;						/* INPUT   NOT YET READ */
+	size_t			input_size;					/* BYTES   OF INPUT     */
+	size_t			input_used;					/* BYTES   READ SO FAR  */
+	size_t			input_alloc;				/* BYTES   ALLOCATED    */
+	int				input_closed;				/* NO MORE    INPUT     */
+	int				parked;						/* TASK    WAITS INPUT  */
+	int				throttled;					/* NOT     READING      */
+	int				reading;					/* EPOLL   WATCHES INPUT*/
+	unsigned char*	out;						/* REPLY   NOT YET SENT */
+	size_t			out_size;					/* BYTES   OF REPLY     */
+	size_t			out_used;					/* BYTES   SENT SO FAR  */
+	size_t			out_alloc;					/* BYTES   ALLOCATED    */
+	int				stalled;					/* TASK    WAITS CLIENT */
+	Task			task;						/* THE     JOB IN       */
+	Connection*		next;						/* NEXT    FINISHED     */
+};
+
+typedef struct QUEUE
+{
+	pthread_mutex_t	lock;						/* GUARDS  THE RING     */
+	Task**			ring;						/* TASKS   FROM HEAD    */
+	size_t			head;						/* FIRST   TASK         */
+	size_t			count;						/* TASKS   QUEUED       */
+	size_t			alloc;						/* SLOTS   IN RING      */
+} Queue;
+
+static Image* images[SERVE_SLOTS];
+static pthread_mutex_t images_lock = PTHREAD_MUTEX_INITIALIZER;
+static int serve_socket = -1;
+static int serve_epoll = -1;
+static int serve_wake[2] = { -1, -1 };
+static int serve_argc = 0;
+static char** serve_argv = NULL;
+static unsigned long serve_quantum = 0;
+static Connection* finished = NULL;
+static pthread_mutex_t finished_lock = PTHREAD_MUTEX_INITIALIZER;
+static Queue queues[SERVE_THREADS];
+static int sched_workers = 1;
+static int sched_waiting = 0;
+static unsigned int sched_next = 0;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_wake = PTHREAD_COND_INITIALIZER;
+static Dao_vm** vms = NULL;
+static size_t vms_count = 0;
+static size_t vms_alloc = 0;
+static pthread_mutex_t vms_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void sched_put(int, Task*);
+
+static unsigned long long serve_hash(unsigned long long hash, const unsigned char* bytes, size_t count)
+{
+	while (count-- > 0)
+		hash = (hash ^ *bytes++) * 1099511628211ULL;
+	return hash;
+}
+
+static unsigned long long serve_number(const unsigned char* bytes, unsigned int count)
+{
+	unsigned long long number = 0;
+	while (count-- > 0)
+		number = (number << 8) | *bytes++;
+	return number;
+}
+
+static long long serve_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+* Asks epoll for the next bytes from conn if it is reading, and for room to write if it has
+* a reply waiting. Each event turns both off until this is called again. The caller holds
+* conn->lock.
+*/
+static void serve_arm(Connection* conn)
+{
+	struct epoll_event event;
+	event.events = EPOLLONESHOT | (conn->reading ? EPOLLIN : 0) | (conn->out_size > conn->out_used ? EPOLLOUT : 0);
+	event.data.ptr = conn;
+	epoll_ctl(serve_epoll, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+/* Writes as much of conn's waiting reply as the socket takes. The caller holds conn->lock. */
+static void serve_flush(Connection* conn)
+{
+	ssize_t sent;
+	while (!conn->dead && conn->out_used < conn->out_size)
+	{
+		if ((sent = write(conn->fd, conn->out + conn->out_used, conn->out_size - conn->out_used)) >= 0)
+			conn->out_used += sent;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+		else if (errno != EINTR)
+			conn->dead = 1;										/* Let the job finish, and drop the rest */
+	}
+	conn->out_size = conn->out_used = 0;
+}
+
+/* Keeps count bytes for the epoll loop to send once the socket has room. The caller holds conn->lock. */
+static void serve_keep(Connection* conn, const void* bytes, size_t count)
+{
+	if (conn->out_used > 0)
+	{
+		memmove(conn->out, conn->out + conn->out_used, conn->out_size - conn->out_used);
+		conn->out_size -= conn->out_used;
+		conn->out_used = 0;
+	}
+	if (conn->out_size + count > conn->out_alloc)
+	{
+		size_t alloc = (conn->out_size + count) * 2;
+		unsigned char* grown = realloc(conn->out, alloc);
+		if (grown == NULL)
+		{
+			printf("Error allocating %d bytes: ", (int)alloc);
+			perror("");
+			abort();
+		}
+		conn->out = grown;
+		conn->out_alloc = alloc;
+	}
+	memcpy(conn->out + conn->out_size, bytes, count);
+	conn->out_size += count;
+}
+
+/*
+* Sends a frame without waiting for the client: what the socket does not take now is kept,
+* behind anything kept before it, and the epoll loop sends it when it can.
+*/
+static int serve_send(Connection* conn, char type, const void* bytes, size_t count)
+{
+	unsigned char frame[5];
+	struct iovec parts[2];
+	ssize_t sent = 0;
+	int alive;
+	frame[0] = (unsigned char)type;
+	frame[1] = (unsigned char)(count >> 24);
+	frame[2] = (unsigned char)(count >> 16);
+	frame[3] = (unsigned char)(count >> 8);
+	frame[4] = (unsigned char)count;
+	parts[0].iov_base = frame;
+	parts[0].iov_len = sizeof(frame);
+	parts[1].iov_base = (void*)bytes;
+	parts[1].iov_len = count;
+	pthread_mutex_lock(&conn->lock);
+	if (!conn->dead && conn->out_size == conn->out_used)		/* Nothing ahead of it: straight to the socket */
+	{
+		while ((sent = writev(conn->fd, parts, 2)) < 0 && errno == EINTR)
+			;
+		if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			conn->dead = 1;										/* Let the job finish, and drop the rest */
+		if (sent < 0)
+			sent = 0;
+	}
+	if (!conn->dead && (size_t)sent < sizeof(frame) + count)
+	{
+		int idle = conn->out_size == conn->out_used;
+		if ((size_t)sent < sizeof(frame))
+			serve_keep(conn, frame + sent, sizeof(frame) - sent);
+		serve_keep(conn, (const unsigned char*)bytes + ((size_t)sent > sizeof(frame) ? sent - sizeof(frame) : 0),
+			count - ((size_t)sent > sizeof(frame) ? sent - sizeof(frame) : 0));
+		if (idle)
+			serve_arm(conn);
+	}
+	alive = !conn->dead;
+	pthread_mutex_unlock(&conn->lock);
+	return alive;
+}
+
+/* Sets a task aside if its client has not taken enough of its output; the caller holds conn->lock. */
+static int serve_stall(Connection* conn)
+{
+	return conn->stalled = !conn->dead && conn->out_size - conn->out_used > SERVE_UNSENT;
+}
+
+static size_t serve_input(void* user, unsigned char* bytes, size_t count)
+{
+	Connection* conn = user;
+	size_t left;
+	pthread_mutex_lock(&conn->lock);
+	left = conn->input_size - conn->input_used;
+	if (left == 0)
+		count = conn->input_closed ? 0 : DAO_AGAIN;
+	else
+	{
+		if (count > left)
+			count = left;
+		memcpy(bytes, conn->input + conn->input_used, count);
+		if ((conn->input_used += count) == conn->input_size)
+			conn->input_used = conn->input_size = 0;
+		if (conn->throttled && conn->input_size - conn->input_used < SERVE_PENDING / 2)
+		{
+			conn->throttled = 0;
+			conn->reading = 1;
+			serve_arm(conn);
+		}
+	}
+	pthread_mutex_unlock(&conn->lock);
+	return count;
+}
+
+static void serve_output(void* user, const char* bytes, size_t count)
+{
+	serve_send(user, 'O', bytes, count);
+}
+
+static void image_drop(Image* image)
+{
+	pthread_mutex_lock(&images_lock);
+	if (--image->refs == 0)
+	{
+		free(image->code);
+		free(image->made);
+		free(image);
+	}
+	pthread_mutex_unlock(&images_lock);
+}
+
+/* The image made from length bytes of what, hashing to key, with a reference held by the caller, or NULL. */
+static Image* image_find(unsigned long long key, const unsigned char* what, size_t length)
+{
+	Image* image;
+	pthread_mutex_lock(&images_lock);
+	if ((image = images[key % SERVE_SLOTS]) != NULL && image->key == key && image->length == length
+		&& memcmp(image->made, what, length) == 0)				/* A hash that matches is not enough */
+		image->refs++;
+	else
+		image = NULL;
+	pthread_mutex_unlock(&images_lock);
+	return image;
+}
+
+/* Puts code in its slot in place of what was there. The caller holds a reference to the image. */
+static Image* image_keep(unsigned long long key, const unsigned char* what, size_t length, unsigned char* code, size_t size)
+{
+	Image* image = malloc(sizeof(Image));
+	Image* old;
+	if (image == NULL || (image->made = malloc(length)) == NULL)
+	{
+		free(image);
+		free(code);
+		return NULL;
+	}
+	memcpy(image->made, what, length);
+	image->key = key;
+	image->length = length;
+	image->code = code;
+	image->size = size;
+	image->refs = 2;											/* The slot, and the job that made it */
+	pthread_mutex_lock(&images_lock);
+	old = images[key % SERVE_SLOTS];
+	images[key % SERVE_SLOTS] = image;
+	pthread_mutex_unlock(&images_lock);
+	if (old != NULL)
+		image_drop(old);
+	return image;
+}
+
+/*
+* The compiled image for a job's program, from its slot if it was seen before. An image is
+* found by what made it: the kind and format of the job, then the program, or for a file its
+* name and the device, inode, size and modification time to the nanosecond it had.
+*/
+static Image* serve_image(Dao_vm* vm, char kind, int format, unsigned char* program, size_t length)
+{
+	struct
+	{
+		unsigned char	kind, format;
+		dev_t			dev;
+		ino_t			ino;
+		off_t			size;
+		long long		sec, nsec;
+	} made;
+	unsigned char* what;
+	unsigned char* source = program;
+	unsigned char* code;
+	unsigned long long key;
+	size_t size = length, kept = sizeof(made);
+	Image* image = NULL;
+	memset(&made, 0, sizeof(made));								/* Padding is compared too */
+	made.kind = (unsigned char)kind;
+	made.format = (unsigned char)format;
+	if (kind == 'F')
+	{
+		struct stat st;
+		program[length] = 0;
+		if (stat((char*)program, &st) != 0)
+			return NULL;
+		made.dev = st.st_dev;
+		made.ino = st.st_ino;
+		made.size = st.st_size;
+		made.sec = (long long)st.st_mtim.tv_sec;
+		made.nsec = (long long)st.st_mtim.tv_nsec;
+	}
+	else
+		kept = 2;												/* The program says the rest */
+	if ((what = malloc(kept + length)) == NULL)
+		return NULL;
+	memcpy(what, &made, kept);
+	memcpy(what + kept, program, length);
+	key = serve_hash(14695981039346656037ULL, what, kept + length);
+	if ((image = image_find(key, what, kept + length)) != NULL)
+	{
+		free(what);
+		return image;
+	}
+	if (kind == 'F')
+	{
+		FILE* file = fopen((char*)program, "rb");
+		if (file == NULL || (source = slurp(file, &size)) == NULL)
+		{
+			if (file != NULL)
+				fclose(file);
+			free(what);
+			return NULL;
+		}
+		fclose(file);
+	}
+	if (format == DAO_COMPILED)
+	{
+		if ((code = malloc(size ? size : 1)) != NULL)
+			memcpy(code, source, size);
+	}
+	else
+		code = dao_compile(vm, source, size, format, &size);
+	if (source != program)
+		free(source);
+	if (code != NULL)
+		image = image_keep(key, what, kept + length, code, size);
+	free(what);
+	return image;
+}
+
+/* A VM from those left by earlier jobs, or a new one with the server's flags. */
+static Dao_vm* vm_take(void)
+{
+	Dao_vm* vm = NULL;
+	int i;
+	pthread_mutex_lock(&vms_lock);
+	if (vms_count > 0)
+		vm = vms[--vms_count];
+	pthread_mutex_unlock(&vms_lock);
+	if (vm == NULL && (vm = dao_new()) != NULL)
+		for (i = 0; i < serve_argc; i++)
+			if (serve_argv[i][0] == '-' && serve_argv[i][1] != 0 && serve_argv[i][2] == 0)
+				dao_option(vm, serve_argv[i][1], 1);
+	return vm;
+}
+
+static void vm_give(Dao_vm* vm)
+{
+	pthread_mutex_lock(&vms_lock);
+	if (vms_count == vms_alloc)
+	{
+		Dao_vm** grown = realloc(vms, (vms_alloc * 2 + 16) * sizeof(Dao_vm*));
+		if (grown != NULL)
+		{
+			vms = grown;
+			vms_alloc = vms_alloc * 2 + 16;
+		}
+	}
+	if (vms_count < vms_alloc)
+	{
+		vms[vms_count++] = vm;
+		vm = NULL;
+	}
+	pthread_mutex_unlock(&vms_lock);
+	if (vm != NULL)
+		dao_free(vm);
+}
+
+/* Puts task at the back of worker w's queue, and wakes a worker to run it. */
+static void sched_put(int w, Task* task)
+{
+	Queue* queue = &queues[w];
+	task->queued = serve_clock();
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count == queue->alloc)
+	{
+		size_t alloc = queue->alloc * 2 + 16, i;
+		Task** ring = malloc(alloc * sizeof(Task*));
+		if (ring == NULL)
+		{
+			printf("Error allocating %d bytes: ", (int)(alloc * sizeof(Task*)));
+			perror("");
+			abort();
+		}
+		for (i = 0; i < queue->count; i++)
+			ring[i] = queue->ring[(queue->head + i) % queue->alloc];
+		free(queue->ring);
+		queue->ring = ring;
+		queue->head = 0;
+		queue->alloc = alloc;
+	}
+	queue->ring[(queue->head + queue->count++) % queue->alloc] = task;
+	pthread_mutex_unlock(&queue->lock);
+	pthread_mutex_lock(&sched_lock);
+	sched_waiting++;
+	pthread_cond_signal(&sched_wake);
+	pthread_mutex_unlock(&sched_lock);
+}
+
+/* Hands a task from the epoll loop to the workers, spread out before any are stolen. */
+static void sched_submit(Task* task)
+{
+	sched_put((int)(sched_next++ % sched_workers), task);
+}
+
+/* The task at the front of worker w's own queue, or else one from the back of another's. */
+static Task* sched_take(int w)
+{
+	Task* task = NULL;
+	int i;
+	for (;;)
+	{
+		for (i = 0; i < sched_workers && task == NULL; i++)
+		{
+			Queue* queue = &queues[(w + i) % sched_workers];
+			pthread_mutex_lock(&queue->lock);
+			if (queue->count > 0 && i == 0)
+			{
+				task = queue->ring[queue->head];
+				queue->head = (queue->head + 1) % queue->alloc;
+				queue->count--;
+			}
+			else if (queue->count > 0)							/* Stolen from the end its owner reaches last */
+				task = queue->ring[(queue->head + --queue->count) % queue->alloc];
+			pthread_mutex_unlock(&queue->lock);
+		}
+		pthread_mutex_lock(&sched_lock);
+		if (task != NULL)
+		{
+			sched_waiting--;
+			pthread_mutex_unlock(&sched_lock);
+			return task;
+		}
+		while (sched_waiting <= 0)
+			pthread_cond_wait(&sched_wake, &sched_lock);
+		pthread_mutex_unlock(&sched_lock);
+	}
+}
+
+/* Loads a task's program into a VM on its first turn, so compiling is off the epoll loop. */
+static int serve_load(Task* task)
+{
+	Connection* conn = task->conn;
+	size_t length = (size_t)serve_number(conn->header + 2, 4);
+	if ((task->vm = vm_take()) == NULL)
+		return 0;
+	if ((task->image = serve_image(task->vm, (char)conn->header[0], conn->header[1], conn->program, length)) == NULL)
+		return 0;
+	dao_io(task->vm, serve_input, serve_output, conn);
+	return dao_load(task->vm, task->image->code, task->image->size, DAO_COMPILED) == 0;
+}
+
+/* Sends the status of a finished task after its statistics, and gives its connection back to the epoll loop. */
+static void serve_finish(Task* task)
+{
+	Connection* conn = task->conn;
+	unsigned long long numbers[6];
+	unsigned char bytes[sizeof(numbers)], status[4];
+	unsigned int i, b;
+	numbers[0] = task->quanta;
+	numbers[1] = task->steps;
+	numbers[2] = (unsigned long long)task->waited;
+	numbers[3] = (unsigned long long)task->waited_max;
+	numbers[4] = (unsigned long long)task->ran;
+	numbers[5] = (unsigned long long)(serve_clock() - task->submitted);
+	for (i = 0; i < 6; i++)
+		for (b = 0; b < 8; b++)
+			bytes[i * 8 + b] = (unsigned char)(numbers[i] >> (56 - 8 * b));
+	for (b = 0; b < 4; b++)
+		status[b] = (unsigned char)((unsigned int)task->status >> (24 - 8 * b));
+	if (task->quanta > 0)
+		serve_send(conn, 'S', bytes, sizeof(bytes));
+	serve_send(conn, 'X', status, 4);
+	if (task->vm != NULL)
+		vm_give(task->vm);
+	if (task->image != NULL)
+		image_drop(task->image);
+	pthread_mutex_lock(&finished_lock);
+	conn->next = finished;
+	finished = conn;
+	pthread_mutex_unlock(&finished_lock);
+	if (write(serve_wake[1], "", 1) < 0)						/* A full pipe has a wake-up in it already */
+		return;
+}
+
+/* Runs a quantum of each task it gets, putting it back on its own queue until it is done or waits for INPUT. */
+static void* sched_worker(void* arg)
+{
+	int w = (int)(size_t)arg;
+	for (;;)
+	{
+		Task* task = sched_take(w);
+		Connection* conn = task->conn;
+		long long start = serve_clock(), wait = start - task->queued;
+		unsigned long slice = serve_quantum;
+		unsigned long long steps;
+		int result, ready, stalled, gone;
+		task->waited += wait;
+		if (wait > task->waited_max)
+			task->waited_max = wait;
+		if (task->vm == NULL && !serve_load(task))
+		{
+			task->status = DAO_ERROR;
+			serve_finish(task);
+			continue;
+		}
+		if (task->budget != 0 && task->budget - task->steps < slice)
+			slice = (unsigned long)(task->budget - task->steps);
+		result = dao_run(task->vm, slice);
+		steps = dao_steps(task->vm);
+		task->ran += serve_clock() - start;
+		task->quanta++;
+		task->steps = steps;
+		if (result == DAO_WAITING)
+		{
+			pthread_mutex_lock(&conn->lock);
+			ready = conn->input_size > conn->input_used || conn->input_closed;
+			conn->parked = !ready;								/* The epoll loop puts it back when INPUT comes */
+			stalled = ready && serve_stall(conn);				/* or when its client has read enough */
+			pthread_mutex_unlock(&conn->lock);
+			if (ready && !stalled)
+				sched_put(w, task);
+			continue;
+		}
+		if (result == DAO_PAUSED && (task->budget == 0 || steps < task->budget))
+		{
+			pthread_mutex_lock(&conn->lock);
+			stalled = serve_stall(conn);
+			gone = conn->dead || conn->hangup;					/* Nobody is left to read what it says */
+			pthread_mutex_unlock(&conn->lock);
+			if (!gone)
+			{
+				if (!stalled)
+					sched_put(w, task);
+				continue;
+			}
+		}
+		task->status = result;
+		serve_finish(task);
+	}
+	return arg;
+}
+
+/* Notes that conn's client is gone. Workers look under conn->lock, so it is set under it. */
+static void serve_hangup(Connection* conn)
+{
+	pthread_mutex_lock(&conn->lock);
+	conn->hangup = 1;
+	pthread_mutex_unlock(&conn->lock);
+}
+
+/* Adds INPUT for the job in, waking it if it was waiting for some. */
+static void serve_append(Connection* conn, const unsigned char* bytes, size_t count)
+{
+	int wake = 0;
+	if (!conn->busy)											/* Left over from a job that ended early */
+		return;
+	pthread_mutex_lock(&conn->lock);
+	if (conn->input_used > 0)
+	{
+		memmove(conn->input, conn->input + conn->input_used, conn->input_size - conn->input_used);
+		conn->input_size -= conn->input_used;
+		conn->input_used = 0;
+	}
+	if (conn->input_size + count > conn->input_alloc)
+	{
+		size_t alloc = (conn->input_size + count) * 2;
+		unsigned char* grown = realloc(conn->input, alloc);
+		if (grown == NULL)
+		{
+			printf("Error allocating %d bytes: ", (int)alloc);
+			perror("");
+			abort();
+		}
+		conn->input = grown;
+		conn->input_alloc = alloc;
+	}
+	memcpy(conn->input + conn->input_size, bytes, count);
+	conn->input_size += count;
+	if (conn->parked && count > 0)
+		conn->parked = 0, wake = 1;
+	pthread_mutex_unlock(&conn->lock);
+	if (wake)
+		sched_submit(&conn->task);
+}
+
+/* Ends the INPUT of the job in, so INPUT past it reads EOF, and moves on once the job is done. */
+static void serve_end_input(Connection* conn)
+{
+	int wake;
+	pthread_mutex_lock(&conn->lock);
+	conn->input_closed = 1;
+	wake = conn->parked;
+	conn->parked = 0;
+	pthread_mutex_unlock(&conn->lock);
+	if (wake)
+		sched_submit(&conn->task);
+	conn->state = conn->busy ? CONN_RUNNING : CONN_HEADER;
+	conn->have = 0;
+}
+
+/* Starts the job whose program is in. */
+static void serve_start(Connection* conn)
+{
+	Task* task = &conn->task;
+	memset(task, 0, sizeof(Task));
+	task->conn = conn;
+	task->budget = serve_number(conn->header + 10, 8);
+	task->submitted = serve_clock();
+	task->status = DAO_ERROR;
+	pthread_mutex_lock(&conn->lock);
+	conn->input_size = conn->input_used = 0;
+	conn->input_closed = conn->parked = conn->throttled = 0;
+	pthread_mutex_unlock(&conn->lock);
+	conn->busy = 1;
+	sched_submit(task);
+}
+
+/* Takes count bytes read from conn, as far as the job in lets it; returns how many it took. */
+static size_t serve_parse(Connection* conn, const unsigned char* bytes, size_t count)
+{
+	const unsigned char* start = bytes;
+	size_t part;
+	for (;;)
+	{
+		if (conn->state == CONN_PROGRAM && conn->left == 0)
+		{
+			unsigned long input = (unsigned long)serve_number(conn->header + 6, 4);
+			serve_start(conn);
+			conn->state = (input == SERVE_STREAM) ? CONN_FRAME : CONN_INPUT;
+			conn->left = (input == SERVE_STREAM) ? 0 : input;
+			conn->have = 0;
+			if (conn->state == CONN_INPUT && conn->left == 0)
+				serve_end_input(conn);
+			continue;
+		}
+		if (count == 0 || conn->state == CONN_RUNNING)
+			return bytes - start;
+		if (conn->state == CONN_HEADER || conn->state == CONN_FRAME)
+		{
+			unsigned char* into = (conn->state == CONN_HEADER) ? conn->header : conn->frame;
+			size_t size = (conn->state == CONN_HEADER) ? SERVE_HEADER : 4;
+			part = (size - conn->have < count) ? size - conn->have : count;
+			memcpy(into + conn->have, bytes, part);
+			if ((conn->have += part) == size && conn->state == CONN_HEADER)
+			{
+				size_t length = (size_t)serve_number(conn->header + 2, 4);
+				if (length + 1 > conn->program_alloc)
+				{
+					unsigned char* grown = realloc(conn->program, length + 1);
+					if (grown == NULL)
+					{
+						serve_hangup(conn);
+						return count;
+					}
+					conn->program = grown;
+					conn->program_alloc = length + 1;
+				}
+				conn->state = CONN_PROGRAM;
+				conn->left = length;
+				conn->have = 0;
+			}
+			else if (conn->have == size)
+			{
+				conn->left = (size_t)serve_number(conn->frame, 4);
+				conn->state = CONN_FRAME_DATA;
+				conn->have = 0;
+				if (conn->left == 0)
+					serve_end_input(conn);
+			}
+		}
+		else
+		{
+			part = (conn->left < count) ? conn->left : count;
+			if (conn->state == CONN_PROGRAM)
+				memcpy(conn->program + conn->have, bytes, part);
+			else
+				serve_append(conn, bytes, part);
+			conn->have += part;
+			if ((conn->left -= part) == 0 && conn->state == CONN_INPUT)
+				serve_end_input(conn);
+			else if (conn->left == 0 && conn->state == CONN_FRAME_DATA)
+			{
+				conn->state = CONN_FRAME;
+				conn->have = 0;
+			}
+		}
+		bytes += part;
+		count -= part;
+	}
+}
+
+static void serve_drop(Connection* conn)
+{
+	epoll_ctl(serve_epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn->program);
+	free(conn->input);
+	free(conn->out);
+	free(conn->stash);
+	free(conn);
+}
+
+/*
+* Reads more of conn unless its job has all it needs, or has too much INPUT in hand, and
+* writes what is kept of its reply. A connection closed by its client goes once the job in is
+* done and the reply has gone.
+*/
+static void serve_rearm(Connection* conn)
+{
+	int unsent, done;
+	pthread_mutex_lock(&conn->lock);
+	if (conn->hangup)
+		conn->reading = 0;
+	else if (conn->state != CONN_RUNNING)
+		conn->reading = !(conn->throttled = (conn->input_size - conn->input_used > SERVE_PENDING));
+	unsent = conn->out_size > conn->out_used;
+	if (!conn->hangup || unsent)
+		serve_arm(conn);
+	done = conn->hangup && !conn->busy && !unsent;
+	pthread_mutex_unlock(&conn->lock);
+	if (done)
+		serve_drop(conn);
+}
+
+/* Parses bytes, keeping what comes after a job in until it is done. */
+static void serve_take(Connection* conn, const unsigned char* bytes, size_t count)
+{
+	size_t took = serve_parse(conn, bytes, count);
+	unsigned char* stash;
+	if (took == count)
+		return;
+	if ((stash = malloc(count - took)) == NULL)
+	{
+		serve_hangup(conn);
+		return;
+	}
+	memcpy(stash, bytes + took, count - took);
+	conn->stash = stash;
+	conn->stash_size = count - took;
+}
+
+static void serve_readable(Connection* conn)
+{
+	static unsigned char bytes[SERVE_READ];
+	ssize_t got = read(conn->fd, bytes, sizeof(bytes));
+	if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+	{
+		serve_hangup(conn);
+		if (conn->busy && conn->state != CONN_RUNNING)			/* Whatever INPUT it was to have is all it gets */
+			serve_end_input(conn);
+	}
+	else if (got > 0)
+		serve_take(conn, bytes, (size_t)got);
+	serve_rearm(conn);
+}
+
+/* Sends what conn has kept when the socket has room, putting back a job that was waiting on it, and reads it if asked. */
+static void serve_event(Connection* conn, unsigned int events)
+{
+	int wake = 0, readable;
+	pthread_mutex_lock(&conn->lock);
+	if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+		serve_flush(conn);
+	if (conn->stalled && conn->out_size - conn->out_used <= SERVE_UNSENT / 2)
+		conn->stalled = 0, wake = 1;
+	if ((readable = conn->reading && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))))
+		conn->reading = 0;
+	pthread_mutex_unlock(&conn->lock);
+	if (wake)
+		sched_submit(&conn->task);
+	if (readable)
+		serve_readable(conn);
+	else
+		serve_rearm(conn);
+}
+
+/* Takes back the connections whose jobs are done, and goes on with what they sent next. */
+static void serve_finished(void)
+{
+	unsigned char drain[64];
+	Connection* conn;
+	while (read(serve_wake[0], drain, sizeof(drain)) > 0)
+		;
+	pthread_mutex_lock(&finished_lock);
+	conn = finished;
+	finished = NULL;
+	pthread_mutex_unlock(&finished_lock);
+	while (conn != NULL)
+	{
+		Connection* next = conn->next;
+		conn->busy = 0;
+		if (conn->state == CONN_RUNNING)
+		{
+			conn->state = CONN_HEADER;
+			conn->have = 0;
+		}
+		if (conn->stash != NULL && !conn->hangup)
+		{
+			unsigned char* stash = conn->stash;
+			conn->stash = NULL;
+			serve_take(conn, stash, conn->stash_size);
+			free(stash);
+		}
+		pthread_mutex_lock(&conn->lock);
+		if (conn->dead)
+			conn->hangup = 1;
+		pthread_mutex_unlock(&conn->lock);
+		serve_rearm(conn);
+		conn = next;
+	}
+}
+
+static void serve_accept(void)
+{
+	struct epoll_event event;
+	Connection* conn;
+	int fd;
+	while ((fd = accept4(serve_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		if ((conn = calloc(1, sizeof(Connection))) == NULL)
+		{
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		conn->reading = 1;
+		pthread_mutex_init(&conn->lock, NULL);
+		event.events = EPOLLIN | EPOLLONESHOT;
+		event.data.ptr = conn;
+		if (epoll_ctl(serve_epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+		{
+			pthread_mutex_destroy(&conn->lock);
+			free(conn);
+			close(fd);
+		}
+	}
+}
+
+static int serve(char* path, int argc, char** argv)
+{
+	pthread_t thread;
+	struct sockaddr_un address;
+	struct epoll_event event, events[SERVE_EVENTS];
+	struct stat st;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int w, n, i, woken;
+	if (argc >= 2 && !strcmp(argv[0], "--quantum"))
+	{
+		serve_quantum = strtoul(argv[1], NULL, 10);
+		argc -= 2;
+		argv += 2;
+	}
+	if (serve_quantum == 0)
+		serve_quantum = SERVE_QUANTUM;
+	sched_workers = (cores < 1) ? 1 : (cores > SERVE_THREADS) ? SERVE_THREADS : (int)cores;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		printf("Socket path \"%s\" is too long.\n", path);
+		return 1;
+	}
+	strcpy(address.sun_path, path);
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))			/* Left behind by an earlier server */
+		unlink(path);
+	if ((serve_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0
+		|| bind(serve_socket, (struct sockaddr*)&address, sizeof(address)) != 0
+		|| listen(serve_socket, SOMAXCONN) != 0)
+	{
+		perror(path);
+		return 1;
+	}
+	if ((serve_epoll = epoll_create1(EPOLL_CLOEXEC)) < 0 || pipe2(serve_wake, O_NONBLOCK | O_CLOEXEC) != 0)
+	{
+		perror("Error starting the event loop");
+		return 1;
+	}
+	event.events = EPOLLIN;
+	event.data.ptr = &serve_socket;
+	epoll_ctl(serve_epoll, EPOLL_CTL_ADD, serve_socket, &event);
+	event.data.ptr = serve_wake;
+	epoll_ctl(serve_epoll, EPOLL_CTL_ADD, serve_wake[0], &event);
+	signal(SIGPIPE, SIG_IGN);									/* A client gone is a failed write, not an exit */
+	serve_argc = argc;
+	serve_argv = argv;
+	for (w = 0; w < sched_workers; w++)
+	{
+		pthread_mutex_init(&queues[w].lock, NULL);
+		if (pthread_create(&thread, NULL, sched_worker, (void*)(size_t)w) != 0)
+		{
+			perror("Error starting workers");
+			return 1;
+		}
+	}
+	printf("Serving on %s with %d workers and quanta of %lu steps.\n", path, sched_workers, serve_quantum);
+	fflush(stdout);
+	for (;;)
+	{
+		if ((n = epoll_wait(serve_epoll, events, SERVE_EVENTS, -1)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return 1;
+		}
+		for (i = woken = 0; i < n; i++)
+			if (events[i].data.ptr == &serve_socket)
+				serve_accept();
+			else if (events[i].data.ptr == serve_wake)
+				woken = 1;
+			else
+				serve_event(events[i].data.ptr, events[i].events);
+		if (woken)												/* Last, as it may drop a connection with an event above */
+			serve_finished();
+	}
+}
+#endif
+
+int main(int argc, char * argv[])
+{
+	FILE* file;
+	Dao_vm* vm;
+	unsigned char* bytes = NULL;
+	size_t count, length;
+	int format = DAO_COMPILED, i, status;
+	char* program = NULL;
+	char* resume = NULL;
+	char* snapshot = NULL;
+	char* named = NULL;
+	char* frozen = NULL;
+	unsigned long every = 0;
+
+#if defined(__linux__)
+	if (argc > 2 && !strcmp(argv[1], "--serve"))
+		return serve(argv[2], argc - 3, argv + 3);
+#endif
+	for (i = 1; i < argc; i++)
+		if (!strcmp(argv[i], "--checkpoint-every") && i + 1 < argc)
+			every = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "--checkpoint-file") && i + 1 < argc)
+			snapshot = argv[++i];
+		else if (!strcmp(argv[i], "--resume") && i + 1 < argc)
+			resume = argv[++i];
+		else if (!strcmp(argv[i], "--freeze") && i + 1 < argc)
+			frozen = argv[++i];
+		else if (program == NULL && (argv[i][0] != '-' || argv[i][1] == 0))
+			program = argv[i];
+	if (program == NULL && resume == NULL)
+	{
+		printf("Use: dao <file> [-flags] [--checkpoint-every steps] [--checkpoint-file snapshot]\n");
+		printf("     dao --resume <snapshot> [-flags] [--checkpoint-every steps]\n");
+		printf("     dao <file> --freeze <image> [-flags]\n");
+#if defined(__linux__)
+		printf("     dao --serve <socket> [--quantum steps] [-flags]\n");
+#endif
+		return 1;
+	}
+	if (resume == NULL)
+	{
+		if ((file = strcmp(program, "-") ? fopen(program, "rb") : stdin) == NULL)
+		{
+			printf("Could not find \"%s\" - is it in this directory?\n", program);
+			return 1;
+		}
+		if ((bytes = slurp(file, &count)) == NULL)
+		{
+			perror("Error reading program");
+			return 1;
+		}
+		if (file != stdin)
+			fclose(file);
+		length = strlen(program);
+		if (!strcmp(program, "-") || (length >= 4 && !strcmp(program + length - 4, ".dao")))
+			format = DAO_SOURCE;
+	}
+	if (snapshot == NULL)
+		snapshot = resume;
+	if (snapshot == NULL && (snapshot = named = malloc(strlen(program) + 6)) != NULL)
+		sprintf(named, "%s.snap", strcmp(program, "-") ? program : "dao");
+
+	vm = dao_new();
+	for (i = 1; i < argc; i++)
+		if (argv[i][0] == '-' && argv[i][1] != 0 && argv[i][2] == 0)
+		{
+			if (argv[i][1] == 'x')
+				format = DAO_HEX;
+			else if (argv[i][1] == 'f')
+				format = DAO_COMPILED;
+			else
+				dao_option(vm, argv[i][1], 1);
+		}
+
+	if (resume != NULL ? dao_restore(vm, resume) != 0 : dao_load(vm, bytes, count, format) != 0)
+	{
+		if (resume != NULL)
+			printf("Could not resume from \"%s\".\n", resume);
+		status = 1;
+	}
+	else if (frozen != NULL && resume == NULL)
+	{
+		if ((status = dao_freeze(vm, frozen)) == DAO_ERROR)
+			printf("Could not write image \"%s\".\n", frozen);
+		status = (status == DAO_ERROR) ? 1 : 0;
+	}
+	else if (every > 0 && snapshot != NULL)
+	{
+		while ((status = dao_run(vm, every)) == DAO_PAUSED)	/* Budgeted runs stop where a snapshot can be taken */
+			if (dao_save(vm, snapshot) != 0)
+				fprintf(stderr, "Could not write checkpoint \"%s\".\n", snapshot);
+		status = (status == DAO_DONE) ? 0 : 1;
+	}
+	else
+		status = dao_run(vm, 0) == DAO_DONE ? 0 : 1;
+	dao_free(vm);
+	free(bytes);
+	free(named);
+	return status;
+}
@@ -0,0 +1,99 @@
+/*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* libdao - the Daoyu interpreter as a library.
+*
+* A Dao_vm holds one program and everything it runs with, so a process can keep as many as
+* it likes, each used by one thread at a time. Load a program with dao_load(), then run it
+* to the end or a budget of steps at a time with dao_run(). READS output and INPUT go to
+* stdout and stdin unless dao_io() gives callbacks for them.
+*
+*	Dao_vm* vm = dao_new();
+*	if (dao_load(vm, source, length, DAO_SOURCE) == 0)
+*		while (dao_run(vm, 10000) == DAO_PAUSED)
+*			;
+*	dao_free(vm);
+*/
+
+#ifndef DAO_H
+#define DAO_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct DAO_VM Dao_vm;
+
+#define DAO_SOURCE		0						/* Symbols, as in a .dao file */
+#define DAO_HEX			1						/* Hex digits 0-9 and A-F, as dao_hex reads */
+#define DAO_COMPILED	2						/* Tetrads, as in a .wuwei file */
+
+#define DAO_DONE		0						/* The program is over */
+#define DAO_PAUSED		1						/* The budget ran out first; run again to go on */
+#define DAO_WAITING		2						/* Stopped at an INPUT that read has no bytes for yet */
+#define DAO_ERROR		(-1)					/* Nothing is loaded, or it could not be */
+
+#define DAO_AGAIN		((size_t)-1)			/* From a Dao_read: no input yet, but more to come */
+
+/* Fills up to count bytes of INPUT and returns how many, 0 at the end of input, or DAO_AGAIN
+* if there are none yet: dao_run() then returns DAO_WAITING, to be called again once there are. */
+typedef size_t	(*Dao_read)(void* user, unsigned char* bytes, size_t count);
+/* Takes count bytes of READS output. */
+typedef void	(*Dao_write)(void* user, const char* bytes, size_t count);
+
+Dao_vm*	dao_new(void);
+void	dao_free(Dao_vm* vm);
+
+/* Sets a command line option by its letter, as 't' for -t. Returns DAO_ERROR if unknown. */
+int		dao_option(Dao_vm* vm, char flag, int on);
+
+/* Sends INPUT and READS through read and write; NULL for either keeps stdin or stdout. */
+void	dao_io(Dao_vm* vm, Dao_read read, Dao_write write, void* user);
+
+/* Compiles source to a malloc()ed image of *compiled bytes, to load later as DAO_COMPILED. */
+unsigned char*	dao_compile(Dao_vm* vm, const void* bytes, size_t count, int format, size_t* compiled);
+
+/* Makes bytes the program of vm, compiling them first unless format is DAO_COMPILED. */
+int		dao_load(Dao_vm* vm, const void* bytes, size_t count, int format);
+
+/* Runs at most budget steps, or to the end if budget is 0. Returns DAO_DONE, DAO_PAUSED or DAO_WAITING. */
+int		dao_run(Dao_vm* vm, unsigned long budget);
+
+/* Runs one step. */
+int		dao_step(Dao_vm* vm);
+
+/* Steps taken by budgeted runs since the program was loaded. */
+unsigned long long	dao_steps(Dao_vm* vm);
+
+/* Writes everything a paused vm needs to go on to the file name, replacing it whole or not at all. */
+int		dao_save(Dao_vm* vm, const char* name);
+
+/* Makes vm what dao_save() left in name, ready for dao_run(). Resume with stdin from the same file
+* and stdout appended to with >>: both are put back where the snapshot was taken. */
+int		dao_restore(Dao_vm* vm, const char* name);
+
+/* Runs a program just loaded up to its first INPUT and saves it there to name, with what it printed
+* on the way, as an image dao_restore() starts later runs from. Returns DAO_PAUSED at an INPUT, or
+* DAO_DONE if there was none; vm goes on from there either way. */
+int		dao_freeze(Dao_vm* vm, const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,19 +23,93 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include "dao.h"
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BULK_X86										/* Vector kernels picked at run time */
+#endif
 
 #define FILE_SYMBOLIC ".dao"
 #define FILE_COMPILED ".wuwei"
 #define DEFAULT_INTERPRET_CELL_LENGTH 32
 #define BITS_IN_BYTE	8
-#define BITS_IN_CELL 	(sizeof(unsigned long) * 8)
+#define BITS_IN_WORD	32						/* Data is printed a word at a time, whatever the cell */
 #define BYTE_MASK		0xff
 
+/*
+* Tapes are arrays of cells, and the cell width is fixed at compile time with
+* -DCELL_BITS=32, 64 or 128. Wider cells move more bits per SWAPS, SPLIT and copy.
+*/
+#if !defined(CELL_BITS)
+#define CELL_BITS		64
+#endif
+#if CELL_BITS == 128 && defined(__SIZEOF_INT128__)
+typedef unsigned __int128	Cell;
+#define cell_swap(c)	(((Cell)__builtin_bswap64((unsigned long long)(c)) << 64) | __builtin_bswap64((unsigned long long)((c) >> 64)))
+#elif CELL_BITS == 64
+typedef unsigned long long	Cell;
+#if defined(_MSC_VER)
+#define cell_swap(c)	_byteswap_uint64(c)
+#else
+#define cell_swap(c)	__builtin_bswap64(c)
+#endif
+#elif CELL_BITS == 32
+typedef unsigned int		Cell;
+#if defined(_MSC_VER)
+#define cell_swap(c)	_byteswap_ulong(c)
+#else
+#define cell_swap(c)	__builtin_bswap32(c)
+#endif
+#else
+#error "CELL_BITS must be 32, 64, or 128 (128 needs __int128)"
+#endif
+
+/*
+* Cells are stored in file byte order, so a program image is a tape as it stands on disk
+* and bit 0 is the top bit of the first byte on any host. cell_value() turns a stored cell
+* into a number whose top bit is its first bit, and turns such a number back.
+*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define cell_value(c)	(c)
+#else
+#define cell_value(c)	cell_swap(c)
+#endif
+#define BITS_IN_CELL 	CELL_BITS
+#define CELL_ONES		(~(Cell)0)
+#define NYBBLE_LOWS		(CELL_ONES / 0xF)		/* The low bit of every nybble */
+
+typedef Cell*			Page;
+typedef Page*			Leaf;
+
+typedef struct NODE
+{
+	struct NODE*	left;						/* FIRST  HALF / NULL */
+	struct NODE*	right;						/* SECOND HALF        */
+	struct NODE*	next;						/* HASH CHAIN / FREE  */
+	Cell			cell;						/* DATA IF ONE CELL   */
+	unsigned long	refs;						/* OWNERS     COUNT   */
+} Node;
+
 typedef struct PATH
 {
 	struct PATH*	owner;						/* OWNER      PROGRAM */
 	struct PATH*	child;						/* CHILD      PROGRAM */
-	unsigned long*	prg_data;					/*		   DATA	      */
+	Cell*			prg_data;					/*		   DATA	      */
 	unsigned long	prg_allocbits;				/* OPEN	   DATA   BITS*/
 	unsigned long	prg_index;					/* INSTRUCTION POINTER*/
 	unsigned char	prg_level;					/* OPERATING   LEVEL  */
@@ -43,64 +117,361 @@ typedef struct PATH
 	unsigned long	sel_index;					/* INDEX  OF SELECTION*/
 	unsigned int    prg_floor;					/* FLOOR  OF PATH     */
 	unsigned long   prg_start;					/* START  OF RUNNING  */
+	unsigned char*	prg_code;					/* DECODED    PROGRAM */
+	size_t			prg_mapped;					/* COMMITTED  BYTES   */
+	size_t			prg_reserved;				/* RESERVED   BYTES   */
+	Leaf*			prg_pages;					/* SPARSE PAGE TABLE  */
+	Node*			prg_tree;					/* SHARED TREE  ROOT  */
 } Pathstrx;
 
 typedef Pathstrx* Path;
 
-static void prompt();
-static void compile(FILE*, FILE*, char*);
-static void interpret(char*);
-
-static void swaps(Path), later(Path), merge(Path), sifts(Path), delev(Path), equal(Path), halve(Path);
-static void uplev(Path), reads(Path), dealc(Path), split(Path), polar(Path), doalc(Path), input(Path), execs(Path, Path);
-
-void 			flip_UL(unsigned long*);
-void			freeparsedargs(char **argv);
-char 			algn(Path);
-char 			getChar(unsigned char);
-char*			bin(unsigned long);
-char*			str_dup(char *s);
-char*			set_option(char*, char);
-char*			l_to_str(unsigned long, unsigned char, unsigned char, unsigned char);
-char**			parsedargs(char *arguments, int *argc);
-static void		skip();
+typedef struct ARENA
+{
+	struct ARENA*	next;						/* NEXT       CHUNK   */
+	size_t			size;						/* BYTES   IN CHUNK   */
+	size_t			used;						/* BYTES   CARVED     */
+} Arena;
+
+#define POOL_CLASSES	48						/* Tape size classes: one cell << class */
+#define POOL_CHUNK		(64 * 1024)				/* Bytes per ordinary arena chunk */
+#define POOL_ALIGN		64						/* Carve on cache line boundaries */
+#define TAPE_MAP_MIN	(256 * 1024)			/* Tapes this many bytes or larger live in reserved address space */
+#define TAPE_RESERVE	((size_t)1 << (sizeof(void*) > 4 ? 36 : 28))	/* Most bytes of address space a mapped tape can have */
+#define TAPE_AHEAD		64						/* A mapped tape reserves this many times what it commits */
+#define PAGE_BYTES		4096					/* Bytes per sparse tape page */
+#define PAGE_CELLS		(PAGE_BYTES / sizeof(Cell))
+#define LEAF_PAGES		512						/* Page pointers per page table leaf */
+#define TAPE_SPARSE_MIN	(4 * PAGE_BYTES)		/* With -z, tapes this many bytes or larger become page tables */
+#define NODE_TABLE_MIN	256						/* Initial buckets of the shared node table */
+
+typedef struct MAPPING
+{
+	struct MAPPING*	next;						/* NEXT       MAPPING */
+	char*			base;						/* RESERVED   ADDRESS */
+	size_t			size;						/* RESERVED   BYTES   */
+} Mapping;
+
+typedef struct POOL
+{
+	Arena*			arena;						/* CHUNKS  IN USE     */
+	Mapping*		maps;						/* MAPPED     TAPES   */
+	struct PATH*	paths;						/* FREE       PATHS   */
+	Cell*			tapes[POOL_CLASSES];		/* FREE TAPES BY SIZE */
+	unsigned long	path_hits;					/* PATHS      REUSED  */
+	unsigned long	path_misses;				/* PATHS      CARVED  */
+	unsigned long	tape_hits;					/* TAPES      REUSED  */
+	unsigned long	tape_misses;				/* TAPES      CARVED  */
+	Node*			nodes;						/* FREE       NODES   */
+	Node**			table;						/* SHARED     NODES   */
+	unsigned long	table_size;					/* BUCKETS IN TABLE   */
+	unsigned long	node_count;					/* NODES   IN TABLE   */
+} Pool;
+
+#define MEMO_SLOTS		1024					/* Remembered EXECS results, one per slot */
+#define MEMO_MAX_CELLS	4096					/* Programs and data larger than this are not remembered */
+#define MEMO_KEY		6						/* Scalars ahead of the cells of a key */
+#define MEMO_RESULT		5						/* Scalars ahead of the cells of a result */
+#define OUT_BYTES		(64 * 1024)				/* READS output is gathered this many bytes at a time */
+#define IN_BYTES		(64 * 1024)				/* INPUT reads a pipe this many bytes at a time */
+#define COMPILE_BYTES	(64 * 1024)				/* Source read, and compiled code written, this many bytes at a time */
+#define COMPILE_CHUNK	(1024 * 1024)			/* With -j, sources are split in chunks of at least this many bytes */
+#define COMPILE_THREADS	64						/* Most chunks compiled at once */
+#define CACHE_PATH		4096					/* Longest path to a cached compile */
+#define CACHE_MAX		(64UL * 1024 * 1024)	/* Bytes the compile cache keeps unless DAO_CACHE_MAX says */
+#define CACHE_DIGEST	32						/* Bytes of SHA-256 ahead of the code in a cache entry */
+
+typedef struct COMPILER
+{
+	const unsigned char* nybbles;				/* SYMBOL  TO NYBBLE  */
+	unsigned char*	out;						/* COMPILED   BYTES   */
+	size_t			used;						/* BYTES   IN OUT     */
+	unsigned char	toWrite;					/* HALF    A BYTE     */
+	unsigned char	emptyBuffer;				/* NO HALF A BYTE     */
+	unsigned char	isComment;					/* IN      COMMENT    */
+	unsigned char	k;							/* BYTES   ON LINE    */
+	Dao_vm*			vm;							/* OPTIONS            */
+} Compiler;
+
+typedef struct CHUNK
+{
+	Compiler		state;						/* STATE   AT START   */
+	const unsigned char* src;					/* SOURCE     BYTES   */
+	size_t			bytes;						/* BYTES   OF SOURCE  */
+	size_t			code;						/* SYMBOLS    KEPT    */
+	size_t			lead;						/* KEPT BEFORE LINE   */
+	size_t			start;						/* NYBBLES    BEFORE  */
+	unsigned char	lined;						/* HAS     LINE END   */
+	unsigned char	opens;						/* ENDS IN COMMENT    */
+} Chunk;
+
+#if !defined(_WIN32)
+typedef struct DIGEST
+{
+	unsigned int	state[8];					/* SHA-256    STATE   */
+	unsigned long long length;					/* BYTES      HASHED  */
+	unsigned char	block[64];					/* BYTES   NOT HASHED */
+	unsigned int	used;						/* BYTES   IN BLOCK   */
+} Digest;
+
+typedef struct CACHED
+{
+	time_t			used;						/* LAST    USED       */
+	off_t			bytes;						/* BYTES   IN ENTRY   */
+	char*			name;						/* ENTRY   FILE NAME  */
+} Cached;
+#endif
+
+typedef struct MEMO
+{
+	unsigned long	hash;						/* HASH    OF KEY     */
+	Cell*			key;						/* STATE   ON ENTRY   */
+	unsigned long	key_cells;					/* CELLS   IN KEY     */
+	Cell*			result;						/* STATE   ON LEAVE   */
+	unsigned long	result_cells;				/* CELLS   IN RESULT  */
+} Memo;
+
+typedef struct FRAME
+{
+	Path			path;						/* RUNNING    PROGRAM */
+	Path			caller;						/* CALLING    PROGRAM */
+} Frame;
+
+#if !defined(DAO_LIBRARY)
+static void prompt(Dao_vm*);
+static void compile(Dao_vm*, FILE*, FILE*, char*);
+static void interpret(Dao_vm*, char*, const unsigned char*, size_t);
+#endif
+static int interpret_load(Dao_vm*, char*, const unsigned char*, size_t);
+static void interpret_end(Dao_vm*);
+#if !defined(DAO_LIBRARY)
+static void compile_run(Dao_vm*, FILE*, char*);
+#endif
+static void compile_emit(Dao_vm*, FILE*, const unsigned char*, size_t);
+static void compile_init(Dao_vm*, Compiler*, unsigned char*, unsigned char*);
+static void compile_source(Dao_vm*, Compiler*, FILE*, const unsigned char*, size_t);
+static void compile_end(Dao_vm*, Compiler*, FILE*);
+#if !defined(DAO_LIBRARY)
+static int compile_cached(Dao_vm*, FILE*, char*, unsigned char*);
+static int cache_load(Dao_vm*, const char*, const unsigned char*);
+static void cache_store(Dao_vm*, const char*, const unsigned char*);
+static void cache_trim(const char*, const char*);
+#endif
+
+static void swaps(Dao_vm*, Path), later(Dao_vm*, Path), merge(Dao_vm*, Path), sifts(Dao_vm*, Path), delev(Dao_vm*, Path), equal(Dao_vm*, Path), halve(Dao_vm*, Path);
+static void uplev(Dao_vm*, Path), reads(Dao_vm*, Path), dealc(Dao_vm*, Path), split(Dao_vm*, Path), polar(Dao_vm*, Path), doalc(Dao_vm*, Path), input(Dao_vm*, Path), execs(Dao_vm*, Path);
+static void idles(Dao_vm*, Path), inert(Dao_vm*, Path), lines(Dao_vm*, Path);
+
+#if !defined(DAO_LIBRARY)
+static void		freeparsedargs(char **argv);
+#endif
+static char		algn(Path);
+static char		getChar(unsigned char);
+static char*	bin(Dao_vm*, unsigned long);
+static char*	str_dup(char *s);
+static char*	set_option(Dao_vm*, char*, char);
+static char*	l_to_str(Dao_vm*, unsigned long, unsigned char, unsigned char, unsigned char);
+#if !defined(DAO_LIBRARY)
+static char**	parsedargs(char *arguments, int *argc);
+#endif
+static void		skip(Dao_vm*);
+#if !defined(DAO_LIBRARY)
 static void 	flags();
 static void 	splash();
-static void		bin_print(Path);
-static void		diagnose(Path, unsigned char);
-static void 	write_by_bit_index(Path, unsigned long, unsigned long, unsigned long);
-unsigned char 	getNybble(char);
-unsigned long 	read_by_bit_index(Path, unsigned long, unsigned long);
-unsigned long 	mask(int);
-
-static unsigned char command = 0;
-static int doloop = 1;
+#endif
+static void		bin_print(Dao_vm*, Path);
+static void		diagnose(Dao_vm*, Path, unsigned char);
+static void 	write_by_bit_index(Dao_vm*, Path, unsigned long, unsigned long, Cell);
+static void		decode(Dao_vm*, Path);
+static void		recode(Path, unsigned long, unsigned long);
+static void		uncode(Dao_vm*, Path);
+static void		leave(Dao_vm*);
+static Path		path_new(Dao_vm*, Path);
+static void		path_free(Dao_vm*, Path);
+static void		pool_reset(Dao_vm*);
+static void		tape_free(Dao_vm*, Cell*, unsigned long);
+static unsigned int	tape_class(unsigned long);
+static Cell*	tape_new(Dao_vm*, unsigned long);
+static Cell*	tape_alloc(Dao_vm*, Path, unsigned long);
+static int		tape_load(Dao_vm*, Path, FILE*, size_t);
+static int		tape_grow(Dao_vm*, Path);
+static size_t	tape_bytes(unsigned long);
+static void		tape_fail(Dao_vm*, size_t);
+static void		tape_shrink(Dao_vm*, Path);
+static void		tape_release(Dao_vm*, Path);
+static Cell		page_read(Path, unsigned long);
+static Cell*	page_write(Dao_vm*, Path, unsigned long);
+static void		page_drop(Dao_vm*, Path, unsigned long);
+static void		page_swap(Dao_vm*, Path, unsigned long, unsigned long);
+static int		sparse_new(Dao_vm*, Path, unsigned long);
+static int		sparse_convert(Dao_vm*, Path, unsigned long);
+static Cell		tree_read(Path, unsigned long);
+static void		tree_write(Dao_vm*, Path, unsigned long, Cell);
+static Node*	tree_node(Path, unsigned long, unsigned long);
+static void		tree_place(Dao_vm*, Path, unsigned long, unsigned long, Node*);
+static Node*	tree_uniform(Dao_vm*, Cell, unsigned int);
+static Node*	node_retain(Node*);
+static Node*	node_cons(Dao_vm*, Node*, Node*);
+static void		node_release(Dao_vm*, Node*);
+static void		tree_convert(Dao_vm*, Path);
+static void		tree_release(Dao_vm*, Path);
+static int		sparse_resize(Dao_vm*, Path, unsigned long, unsigned long);
+static void		sparse_shrink(Dao_vm*, Path);
+static void		sparse_release(Dao_vm*, Path);
+static int		memo_key(Dao_vm*, Path);
+static int		memo_recall(Dao_vm*, Path);
+static void		memo_store(Dao_vm*, Path);
+static void		memo_drop(Dao_vm*, Memo*);
+static void		sparse_setup(void);
+static void		bulk_swap_cells(Cell*, Cell*, size_t);
+static void		sift_cells_plain(Cell*, unsigned long, unsigned int);
+static void		bulk_setup(void);
+static void		out_write(Dao_vm*, const char*, size_t);
+static void		out_flush(Dao_vm*);
+static int		in_get(Dao_vm*);
+static void		in_unmap(Dao_vm*);
+static int		in_wait(Dao_vm*, Path);
+static unsigned char* in_room(Dao_vm*, size_t);
+static void		in_fill(Dao_vm*, unsigned char*, size_t);
+static void		run(Dao_vm*, unsigned long);
+static void		run_decoded(Dao_vm*, unsigned long);
+static unsigned char getNybble(char);
+static unsigned char getHexNybble(char);
+static Cell		read_by_bit_index(Path, unsigned long, unsigned long);
+static void		cell_bits_write(Dao_vm*, Path, unsigned long, unsigned long, Cell);
+static Cell		mask(int);
 
-typedef void(*PathFunc)(Path);
+typedef void(*PathFunc)(Dao_vm*, Path);
 
-static PathFunc functions[16] = \
-	{NULL, swaps, later, merge, \
-	sifts, NULL , delev, equal, \
-	halve, uplev, reads, dealc, \
-	split, polar, doalc, input};
+/*
+* One dispatch table per operating level. Symbols disabled at a level are inert there, and
+* symbols whose meaning changes (SPLIT as HALVE, LATER without MERGE) are remapped.
+* OPS always points at the table for the level of the running path.
+*/
+static PathFunc functions[10][16] = \
+	{{idles, swaps, later, merge, sifts, execs, delev, equal, halve, uplev, reads, dealc, split, polar, doalc, input},	/* 0 */
+	 {idles, inert, later, merge, sifts, execs, delev, equal, halve, uplev, reads, dealc, halve, polar, inert, input},	/* 1 */
+	 {idles, inert, later, merge, sifts, execs, delev, equal, halve, uplev, reads, inert, halve, polar, inert, input},	/* 2 */
+	 {idles, inert, later, merge, sifts, execs, delev, equal, halve, uplev, reads, inert, halve, inert, inert, input},	/* 3 */
+	 {idles, inert, lines, merge, sifts, execs, delev, equal, halve, uplev, reads, inert, halve, inert, inert, input},	/* 4 */
+	 {idles, inert, lines, merge, inert, execs, delev, inert, halve, uplev, reads, inert, halve, inert, inert, input},	/* 5 */
+	 {idles, inert, lines, merge, inert, execs, delev, inert, halve, uplev, inert, inert, halve, inert, inert, inert},	/* 6 */
+	 {idles, inert, lines, inert, inert, execs, delev, inert, inert, uplev, inert, inert, inert, inert, inert, inert},	/* 7 */
+	 {idles, inert, lines, inert, inert, inert, delev, inert, inert, uplev, inert, inert, inert, inert, inert, inert},	/* 8 */
+	 {idles, inert, lines, inert, inert, inert, delev, inert, inert, inert, inert, inert, inert, inert, inert, inert}};	/* 9 */
 
-const struct PATH NEW_PATH = { NULL, NULL, NULL, 1, 0, 0, 1, 0, 0, 0 };
+static const struct PATH NEW_PATH = { NULL, NULL, NULL, 1, 0, 0, 1, 0, 0, 0, NULL, 0, 0, NULL, NULL };
 
 #define is_option(str) (str[0] == '-' && str[1] != 0 && str[2] == 0)
 #define verbprint(x) verbosely{printf(x);}
 #define verbosely if (VERBOSE)
 
-static char VERBOSE = 0,
-			COMP_ONLY = 0,
-			FORCE = 0,
-			HIDE_DATA = 0,
-			PRINT_CODE = 0,
-			SKIP_OVERFLOW = 0,
-			PRINT_EVERYTHING = 0;
-static Path P_RUNNING = NULL,
-			P_WRITTEN = NULL;
+/*
+* Everything one running program touches lives in its Dao_vm: the running and written paths,
+* the options, the pools, frames and memos, and the input and output buffers. Handlers and
+* helpers take it first, so any number of VMs can run in one process, one thread each.
+*/
+struct DAO_VM
+{
+	Path			running;					/* RUNNING    PROGRAM */
+	Path			written;					/* WRITTEN    PROGRAM */
+	PathFunc*		ops;						/* LEVEL   DISPATCH   */
+	unsigned char	command;					/* CURRENT    SYMBOL  */
+	int				doloop;						/* STILL   RUNNING    */
+	char			verbose, comp_only, force, hide_data, print_code, skip_overflow, print_everything;
+	char			threaded, sparse, tree, memo, flush_lines, flush_reads;
+	char			hex_source, split_compile, no_wuwei, cache;
+	Pool			pool;						/* PATHS, TAPES, NODES*/
+	Frame*			frames;						/* CALL       STACK   */
+	unsigned long	frame_count;				/* FRAMES  IN USE     */
+	unsigned long	frame_alloc;				/* FRAMES  ALLOCATED  */
+	Memo			memos[MEMO_SLOTS];			/* REMEMBERED  EXECS  */
+	Memo			memo_open;					/* EXECS   BEING TRIED*/
+	unsigned long	memo_frame;					/* FRAME   OF OPEN    */
+	unsigned long	memo_hits;					/* EXECS   RECALLED   */
+	unsigned long	memo_misses;				/* EXECS   RUN        */
+	char			memo_pure;					/* NO I/O  SINCE OPEN */
+	char			out_buf[OUT_BYTES];			/* READS   OUTPUT     */
+	size_t			out_used;					/* BYTES   IN OUT_BUF */
+	char			out_lines;					/* FLUSH   AT NEWLINE */
+	char			out_newline;				/* NEWLINE IN OUT_BUF */
+	unsigned char	in_block[IN_BYTES];			/* INPUT   READ AHEAD */
+	unsigned char*	in_next;					/* NEXT    INPUT BYTE */
+	unsigned char*	in_end;						/* END     OF INPUT   */
+	unsigned char*	in_wide;					/* WIDE    INPUT BYTES*/
+	size_t			in_wide_alloc;				/* BYTES   ALLOCATED  */
+	char			in_bulk;					/* STDIN   IN BLOCKS  */
+	char			in_ready;					/* 1 LOOKED, 2 MAPPED */
+	void*			in_map;						/* STDIN   MAPPED     */
+	size_t			in_map_size;				/* BYTES   MAPPED     */
+	unsigned char*	compiled;					/* CODE IN MEMORY     */
+	size_t			compiled_size;				/* BYTES   COMPILED   */
+	size_t			compiled_alloc;				/* BYTES   ALLOCATED  */
+	char			digits[35];					/* L_TO_STR   TEXT    */
+	Pathstrx		root;						/* TOP-LEVEL  PROGRAM */
+	unsigned long	root_bytes;					/* BYTES, 0 IF NONE   */
+	char			budgeted;					/* STEPS   ARE LIMITED*/
+	unsigned long	steps;						/* STEPS   LEFT       */
+	unsigned long long	ran;					/* STEPS   SINCE LOAD */
+	char			waiting;					/* STOPPED AT INPUT   */
+	Dao_read		read;						/* INPUT   CALLBACK   */
+	Dao_write		write;						/* READS   CALLBACK   */
+	void*			user;						/* CALLBACK   ARGUMENT*/
+};
+
+#define P_RUNNING		(vm -> running)
+#define P_WRITTEN		(vm -> written)
+#define OPS				(vm -> ops)
+#define VERBOSE			(vm -> verbose)
+#define COMP_ONLY		(vm -> comp_only)
+#define FORCE			(vm -> force)
+#define HIDE_DATA		(vm -> hide_data)
+#define PRINT_CODE		(vm -> print_code)
+#define SKIP_OVERFLOW	(vm -> skip_overflow)
+#define PRINT_EVERYTHING (vm -> print_everything)
+#define THREADED		(vm -> threaded)
+#define SPARSE			(vm -> sparse)
+#define TREE			(vm -> tree)
+#define MEMO			(vm -> memo)
+#define FLUSH_LINES		(vm -> flush_lines)
+#define FLUSH_READS		(vm -> flush_reads)
+#define HEX_SOURCE		(vm -> hex_source)
+#define SPLIT_COMPILE	(vm -> split_compile)
+#define NO_WUWEI		(vm -> no_wuwei)
+#define CACHE			(vm -> cache)
+
+static void (*bulk_swap)(Cell*, Cell*, size_t) = bulk_swap_cells;
+static void (*sift_cells)(Cell*, unsigned long, unsigned int) = sift_cells_plain;
 static const char* symbols = ".!/)%#>=(<:S[*$;";
 
+/*
+* Tables every VM shares are filled once, before the first VM exists, so VMs on separate
+* threads only ever read them.
+*/
+static void dao_setup(void)
+{
+	sparse_setup();
+	bulk_setup();
+#if defined(__GNUC__)
+	run_decoded(NULL, 0);
+#endif
+}
+
+#if defined(_WIN32)
+static INIT_ONCE setup_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK dao_setup_once(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	(void)once; (void)param; (void)context;
+	dao_setup();
+	return TRUE;
+}
+#define DAO_SETUP()		InitOnceExecuteOnce(&setup_once, dao_setup_once, NULL, NULL)
+#else
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+#define DAO_SETUP()		pthread_once(&setup_once, dao_setup)
+#endif
+
 /***
  *    ooo        ooooo       .o.       ooooo ooooo      ooo 
  *    `88.       .888'      .888.      `888' `888b.     `8' 
@@ -114,47 +485,201 @@ static const char* symbols = ".!/)%#>=(<:S[*$;";
  *                                                          
  */
 
+#if !defined(DAO_LIBRARY)
 int main(int argc, char * argv[])
 {
 	char* fileName = NULL;
 	FILE* inputFile = NULL;
+	Dao_vm* vm = dao_new();
 
 	if (argc < 2)
 	{
 		splash();
-		prompt();
+		prompt(vm);
+		dao_free(vm);
 		return 0;
 	}
 	else
 		fileName = argv[1];
 
 	while (argc-- > 2)
-		if (is_option(argv[argc])) set_option(argv[argc], 1);
+		if (is_option(argv[argc])) set_option(vm, argv[argc], 1);
+
+#if !defined(_WIN32)
+	vm -> in_bulk = !isatty(fileno(stdin));							/* Nothing else reads stdin, so take it in blocks	*/
+#endif
+
+	if (!strcmp(fileName, "-"))										/* The program comes down stdin					*/
+	{
+		if (!FORCE && COMP_ONLY)
+			compile(vm, stdin, stdout, fileName);
+		else if (!FORCE)
+			compile_run(vm, stdin, fileName);
+		else if (!COMP_ONLY)										/* Already compiled: take it as it is				*/
+		{
+			unsigned char block[COMPILE_BYTES];
+			size_t got;
+			vm -> compiled_size = 0;
+			compile_emit(vm, NULL, block, 0);
+			while ((got = fread(block, 1, COMPILE_BYTES, stdin)) > 0)
+				compile_emit(vm, NULL, block, got);
+			interpret(vm, fileName, vm -> compiled, vm -> compiled_size);
+		}
+		dao_free(vm);
+		return 0;
+	}
 
 	if ((inputFile = fopen(fileName, "rb")) == NULL)
 	{
 		printf("Could not find \"%s\" - is it in this directory?\n", fileName);
-		fclose(inputFile);
+		dao_free(vm);
 		return 1;
 	}
 
 	if (~strcmp(FILE_SYMBOLIC, &fileName[strlen(fileName) - 4]))
 	{
-		FILE* outputFile = NULL;
 		fileName[strlen(fileName) - 4] = 0;
 		fileName = strncat(fileName, FILE_COMPILED, sizeof(FILE_COMPILED));
-		outputFile = fopen(fileName, "wb+");
-		compile(inputFile, outputFile, fileName);
-	}
-
-	if (COMP_ONLY)
+		if (COMP_ONLY)
+		{
+			FILE* outputFile = fopen(fileName, "wb+");
+			if (outputFile == NULL)
+			{
+				printf("Could not write \"%s\": ", fileName);
+				perror("");
+				fclose(inputFile);
+				dao_free(vm);
+				return 1;
+			}
+			compile(vm, inputFile, outputFile, fileName);
+		}
+		else
+			compile_run(vm, inputFile, fileName);					/* Straight from memory, no reading back			*/
+		dao_free(vm);
 		return 0;
+	}
 
-	if (FORCE || ~strcmp(FILE_COMPILED, &fileName[strlen(fileName) - 6]))
-		interpret(fileName);
+	fclose(inputFile);
+	if (!COMP_ONLY && (FORCE || ~strcmp(FILE_COMPILED, &fileName[strlen(fileName) - 6])))
+		interpret(vm, fileName, NULL, 0);
 
+	dao_free(vm);
 	return 0;
 }
+#endif
+
+/*
+* The library interface, declared in dao.h. dao_load() leaves the program entered but not
+* started, and dao_run() goes on from wherever the last run stopped. A budgeted run takes
+* the plain loop in run(), which counts steps, and not the threaded one. Either loop stops
+* short of an INPUT whose bytes the read callback does not have yet; see in_wait().
+*/
+Dao_vm* dao_new()
+{
+	Dao_vm* vm;
+	DAO_SETUP();
+	vm = calloc(1, sizeof(Dao_vm));
+	if (vm == NULL)
+	{
+		printf("Error allocating %d bytes: ", (int)sizeof(Dao_vm));
+		perror("");
+		abort();
+	}
+	vm -> doloop = 1;
+	OPS = functions[0];
+	vm -> in_next = vm -> in_end = vm -> in_block;
+	return vm;
+}
+
+void dao_free(Dao_vm* vm)
+{
+	out_flush(vm);
+	if (vm -> root_bytes)
+		interpret_end(vm);
+	pool_reset(vm);
+	in_unmap(vm);
+	free(vm -> frames);
+	free(vm -> compiled);
+	free(vm -> in_wide);
+	free(vm);
+}
+
+int dao_option(Dao_vm* vm, char flag, int on)
+{
+	char option[3] = { '-', flag, 0 };
+	return set_option(vm, option, (char)(on != 0)) != NULL ? 0 : DAO_ERROR;
+}
+
+void dao_io(Dao_vm* vm, Dao_read read, Dao_write write, void* user)
+{
+	out_flush(vm);
+	vm -> read = read;
+	vm -> write = write;
+	vm -> user = user;
+	vm -> in_bulk = (read != NULL);								/* Callbacks are read a block at a time				*/
+	vm -> in_next = vm -> in_end = vm -> in_block;
+}
+
+unsigned char* dao_compile(Dao_vm* vm, const void* bytes, size_t count, int format, size_t* compiled)
+{
+	unsigned char nybbles[256], dst[COMPILE_BYTES];
+	unsigned char* code;
+	Compiler c = { NULL, NULL, 0, 0, 1, 0, 0, NULL };
+	if (format != DAO_SOURCE && format != DAO_HEX)
+		return NULL;
+	HEX_SOURCE = (format == DAO_HEX);
+	compile_init(vm, &c, nybbles, dst);
+	compile_source(vm, &c, NULL, bytes, count);
+	compile_end(vm, &c, NULL);
+	code = vm -> compiled;											/* The caller has it from here						*/
+	*compiled = vm -> compiled_size;
+	vm -> compiled = NULL;
+	vm -> compiled_size = vm -> compiled_alloc = 0;
+	return code;
+}
+
+int dao_load(Dao_vm* vm, const void* bytes, size_t count, int format)
+{
+	unsigned char* code;
+	size_t size;
+	int loaded;
+	if (bytes == NULL)												/* Nothing at all is still a program				*/
+		bytes = "";
+	if (vm -> root_bytes)
+		interpret_end(vm);
+	if (format == DAO_COMPILED)
+		return interpret_load(vm, "memory", bytes, count) ? 0 : DAO_ERROR;
+	if ((code = dao_compile(vm, bytes, count, format, &size)) == NULL)
+		return DAO_ERROR;
+	loaded = interpret_load(vm, "memory", code, size);
+	free(code);														/* The tape has its own copy						*/
+	return loaded ? 0 : DAO_ERROR;
+}
+
+int dao_run(Dao_vm* vm, unsigned long budget)
+{
+	if (!vm -> root_bytes)
+		return DAO_ERROR;
+	vm -> budgeted = (budget != 0);
+	vm -> steps = budget;
+	vm -> waiting = 0;
+	run(vm, 0);
+	if (vm -> budgeted)
+		vm -> ran += budget - (vm -> steps + 1 == 0 ? 0 : vm -> steps);		/* Steps end at -1 when they run out				*/
+	vm -> budgeted = 0;
+	out_flush(vm);
+	return vm -> waiting ? DAO_WAITING : vm -> frame_count ? DAO_PAUSED : DAO_DONE;
+}
+
+int dao_step(Dao_vm* vm)
+{
+	return dao_run(vm, 1);
+}
+
+unsigned long long dao_steps(Dao_vm* vm)
+{
+	return vm -> ran;
+}
 
 /***
  *      .oooooo.     .oooooo.   ooo        ooooo ooooooooo.   ooooo ooooo        oooooooooooo 
@@ -169,151 +694,770 @@ int main(int argc, char * argv[])
  *                                                                                            
  */
 
-static void compile(FILE* input, FILE* output, char* inputFileName)
+/*
+* The compiler takes the source COMPILE_BYTES at a time and looks at it 64 bytes at once.
+* Spaces, comment marks and line ends become bitmasks, comments become a mask running from
+* each '@' to the next line end, and what is left is code, translated through a 256-entry
+* table for the symbol or hex front-end. Whole blocks of code are packed two symbols to a
+* byte without looking at the masks again. Compiled bytes go out COMPILE_BYTES at a time.
+*/
+#if defined(__GNUC__)
+#define bit_first(m)	((unsigned int)__builtin_ctzll(m))
+#else
+static unsigned int bit_first(unsigned long long m)
 {
-	unsigned char emptyBuffer = 1, toWrite = 0, isComment = 0, k = 0;
-	int ch;
-	verbosely printf("\n%s%s\n", "Compiling to ", inputFileName);
-	while ((ch = fgetc(input)) != EOF)
+	unsigned int i = 0;
+	for (; !(m & 1); m >>= 1)
+		i++;
+	return i;
+}
+#endif
+
+static void compile_masks(const unsigned char* src, unsigned int count, unsigned long long* space, unsigned long long* at, unsigned long long* line)
+{
+	unsigned int i = 0;
+	*space = *at = *line = 0;
+#if defined(BULK_X86) && defined(__SSE2__)
+	if (count == 64)
 	{
-		switch ((char)ch)
+		for (; i < 64; i += 16)
 		{
-		case '\t':			case ' ':			break;
-		case '@': 			isComment = 1; 		break;
-		case (char)0x0D:
-		case (char)0x0A: 	isComment = 0; 		break;
-		default:
-			if (isComment)
-				break;
-			verbosely putchar((char)ch);
-			if (!emptyBuffer)
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+			*space |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')))) << i;
+			*at |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('@'))) << i;
+			*line |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x0D)), _mm_cmpeq_epi8(v, _mm_set1_epi8(0x0A)))) << i;
+		}
+		return;
+	}
+#endif
+	for (; i < count; i++)
+		switch (src[i])
+		{
+		case '\t':	case ' ':	*space |= 1ULL << i;	break;
+		case '@':				*at |= 1ULL << i;		break;
+		case 0x0D:	case 0x0A:	*line |= 1ULL << i;		break;
+		}
+}
+
+/* Bits from each '@' to the next line end, carrying an open comment in and out through isComment. */
+static unsigned long long compile_comments(unsigned long long at, unsigned long long line, unsigned char* isComment)
+{
+	unsigned long long comment = 0, rest;
+	unsigned int p = 0;
+	while (p < 64)
+	{
+		if (*isComment)
+		{
+			if ((rest = line & (~0ULL << p)) == 0)
+				return comment | (~0ULL << p);
+			comment |= (~0ULL << p) & ((1ULL << bit_first(rest)) - 1);
+			*isComment = 0;
+			p = bit_first(rest) + 1;
+		}
+		else
+		{
+			if ((rest = at & (~0ULL << p)) == 0)
+				return comment;
+			*isComment = 1;
+			p = bit_first(rest) + 1;
+		}
+	}
+	return comment;
+}
+
+static void compile_block(Compiler* c, const unsigned char* src, unsigned int count)
+{
+	Dao_vm* vm = c->vm;
+	unsigned long long space, at, line, code;
+	unsigned int j;
+	compile_masks(src, count, &space, &at, &line);
+	code = ~(space | at | line | compile_comments(at, line, &c->isComment));
+	if (count < 64)
+		code &= (1ULL << count) - 1;
+	if (code == ~0ULL && c->emptyBuffer && !VERBOSE)							/* All code: pack it in pairs		*/
+	{
+		for (j = 0; j < 64; j += 2)
+			c->out[c->used++] = (unsigned char)((c->nybbles[src[j]] << 4) | c->nybbles[src[j + 1]]);
+		return;
+	}
+	for (; code != 0; code &= code - 1)
+	{
+		unsigned char ch = src[bit_first(code)];
+		verbosely putchar((char)ch);
+		if (!c->emptyBuffer)
+		{
+			c->toWrite |= c->nybbles[ch];
+			c->out[c->used++] = c->toWrite;
+			verbosely printf(" %s ", l_to_str(vm, c->toWrite, 2, 16, 1));
+			if (++c->k == 8)
 			{
-				toWrite |= getNybble((char)ch);
-				fputc(toWrite, output);
-				verbosely printf(" %s ", l_to_str(toWrite, 2, 16, 1));
-				if (++k == 8)
-				{
-					k = 0; 
-					verbosely putchar('\n');
-				}
+				c->k = 0;
+				verbosely putchar('\n');
 			}
-			else
-				toWrite = (char)(getNybble((char)ch) << 4);
-			emptyBuffer = !emptyBuffer;
-			break;
 		}
+		else
+			c->toWrite = (unsigned char)(c->nybbles[ch] << 4);
+		c->emptyBuffer = !c->emptyBuffer;
 	}
+}
 
-	if (!emptyBuffer) {
-		fputc(toWrite, output);
-		verbosely printf(". %x\n", toWrite);
+#if !defined(DAO_LIBRARY)
+static int compile_split(Dao_vm*, FILE*, FILE*, const unsigned char*);
+
+static void compile(Dao_vm* vm, FILE* input, FILE* output, char* inputFileName)
+{
+	unsigned char src[COMPILE_BYTES], dst[COMPILE_BYTES];
+	unsigned char nybbles[256];
+	Compiler c = { NULL, NULL, 0, 0, 1, 0, 0, NULL };
+	size_t got;
+	verbosely printf("\n%s%s\n", "Compiling to ", inputFileName);
+	compile_init(vm, &c, nybbles, dst);
+	if (!(SPLIT_COMPILE && !VERBOSE && compile_split(vm, input, output, nybbles)))
+	{
+		while ((got = fread(src, 1, COMPILE_BYTES, input)) > 0)
+			compile_source(vm, &c, output, src, got);
+		compile_end(vm, &c, output);
 	}
 
 	verbprint("Finished compiling.\n");
-	fclose(input);
-	fclose(output);
+	if (input != stdin)
+		fclose(input);
+	if (output != NULL && output != stdout)
+		fclose(output);
+	else if (output == stdout)
+		fflush(stdout);
 }
+#endif
 
-#define rc(r,c) case c: return r;
+/* Readies c to compile into dst, with the output in memory emptied. */
+static void compile_init(Dao_vm* vm, Compiler* c, unsigned char* nybbles, unsigned char* dst)
+{
+	unsigned int j;
+	for (j = 0; j < 256; j++)
+		nybbles[j] = HEX_SOURCE ? getHexNybble((char)j) : getNybble((char)j);
+	c->nybbles = nybbles;
+	c->out = dst;
+	c->vm = vm;
+	vm -> compiled_size = 0;
+}
 
-unsigned char getNybble(char ch)
+/* Compiles count bytes of source, passing code on to output whenever c->out fills. */
+static void compile_source(Dao_vm* vm, Compiler* c, FILE* output, const unsigned char* src, size_t count)
 {
-	switch (ch)
+	size_t i;
+	for (i = 0; i < count; i += 64)
 	{
-		rc(0x0, '.')	rc(0x1, '!')	rc(0x2, '/')	rc(0x3, ']': case ')')
-		rc(0x4, '%')	rc(0x5, '#')	rc(0x6, '>')	rc(0x7, '=')
-		rc(0x8, '(')	rc(0x9, '<')	rc(0xA, ':')	rc(0xB, 'S')
-		rc(0xC, '[')	rc(0xD, '*')	rc(0xE, '$')	rc(0xF, ';')
-		default: return 0x0;
+		if (c->used > COMPILE_BYTES - 32)
+		{
+			compile_emit(vm, output, c->out, c->used);
+			c->used = 0;
+		}
+		compile_block(c, src + i, (count - i < 64) ? (unsigned int)(count - i) : 64);
 	}
 }
 
-/***
- *    ooooo ooooo      ooo ooooooooooooo oooooooooooo ooooooooo.   ooooooooo.   ooooooooo.   oooooooooooo ooooooooooooo 
- *    `888' `888b.     `8' 8'   888   `8 `888'     `8 `888   `Y88. `888   `Y88. `888   `Y88. `888'     `8 8'   888   `8 
- *     888   8 `88b.    8       888       888          888   .d88'  888   .d88'  888   .d88'  888              888      
- *     888   8   `88b.  8       888       888oooo8     888ooo88P'   888ooo88P'   888ooo88P'   888oooo8         888      
- *     888   8     `88b.8       888       888    "     888`88b.     888          888`88b.     888    "         888      
- *     888   8       `888       888       888       o  888  `88b.   888          888  `88b.   888       o      888      
- *    o888o o8o        `8      o888o     o888ooooood8 o888o  o888o o888o        o888o  o888o o888ooooood8     o888o     
- *                                                                                                                      
- *                                                                                                                      
- *                                                                                                                      
- */
+/* Passes on the rest of the code, with any last half byte. */
+static void compile_end(Dao_vm* vm, Compiler* c, FILE* output)
+{
+	if (!c->emptyBuffer) {
+		c->out[c->used++] = c->toWrite;
+		verbosely printf(". %x\n", c->toWrite);
+	}
+	compile_emit(vm, output, c->out, c->used);
+}
 
-static void interpret(char* inputFileName)
+/* Writes compiled code to output, or with no output keeps it in memory for interpret(). */
+static void compile_emit(Dao_vm* vm, FILE* output, const unsigned char* bytes, size_t count)
 {
-	FILE* inputFile = fopen(inputFileName, "rb");
-	unsigned long bytes_read = 0;	
+	if (output != NULL)
+	{
+		fwrite(bytes, 1, count, output);
+		return;
+	}
+	if (vm -> compiled == NULL || vm -> compiled_size + count > vm -> compiled_alloc)	/* Empty code still gets an image		*/
+	{
+		size_t grown = vm -> compiled_alloc ? vm -> compiled_alloc : COMPILE_BYTES;
+		unsigned char* moved;
+		while (grown < vm -> compiled_size + count)
+			grown <<= 1;
+		if ((moved = realloc(vm -> compiled, grown)) == NULL)
+			tape_fail(vm, grown);
+		vm -> compiled = moved;
+		vm -> compiled_alloc = grown;
+	}
+	if (count)
+		memcpy(vm -> compiled + vm -> compiled_size, bytes, count);
+	vm -> compiled_size += count;
+}
 
-	/*************************                           RUN THE CODE                           *************************/
-	unsigned long 	print_index = 0;								/* Index for printing                               */
-	unsigned long	bytes_alloc = 0;								/* Bytes allocated to data                          */
-	unsigned long	file_size = 0;									/* Byte size of file 								*/
-	unsigned long	shift = 0;										/* Shift for first one of file size for rounding    */
+#if !defined(DAO_LIBRARY)
+/* Compiles a source into memory and runs it from there, writing exeName too unless -n is on. */
+static void compile_run(Dao_vm* vm, FILE* input, char* exeName)
+{
+	FILE* output;
+	char entry[CACHE_PATH];
+	unsigned char digest[CACHE_DIGEST];
+	int cached = (CACHE || getenv("DAO_CACHE") != NULL) && !VERBOSE && input != stdin && compile_cached(vm, input, entry, digest);
+	if (cached && cache_load(vm, entry, digest))
+		fclose(input);												/* Compiled before: nothing to do				*/
+	else
+	{
+		compile(vm, input, NULL, exeName);
+		if (cached)
+			cache_store(vm, entry, digest);
+	}
+	if (!NO_WUWEI && input != stdin && (output = fopen(exeName, "wb")) != NULL)
+	{
+		fwrite(vm -> compiled, 1, vm -> compiled_size, output);
+		fclose(output);
+	}
+	interpret(vm, exeName, vm -> compiled, vm -> compiled_size);
+	free(vm -> compiled);
+	vm -> compiled = NULL;
+	vm -> compiled_size = vm -> compiled_alloc = 0;
+}
 
-	struct PATH newpath = NEW_PATH;									/* Make a new PATH with the initialization values.	*/
-	Path dao = &newpath;											/* Make a pointer to the newly initialized PATH.	*/
+#if !defined(_WIN32)
+static const unsigned int digest_rounds[64] = \
+	{0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, \
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, \
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, \
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, \
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, \
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, \
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, \
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
 
-	verbosely
+#define ROTR(x, n)		(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void digest_block(Digest* d, const unsigned char* b)
+{
+	unsigned int w[64], v[8], s0, s1, t1, t2;
+	int i;
+	for (i = 0; i < 16; i++)
+		w[i] = (unsigned int)b[4 * i] << 24 | (unsigned int)b[4 * i + 1] << 16 | (unsigned int)b[4 * i + 2] << 8 | b[4 * i + 3];
+	for (; i < 64; i++)
 	{
-		printf("\n\n\t=====================\n"  );
-		printf(    "\t|Beginning Execution|\n"  );
-		printf(    "\t=====================\n\n");
+		s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	memcpy(v, d->state, sizeof(v));
+	for (i = 0; i < 64; i++)
+	{
+		t1 = v[7] + (ROTR(v[4], 6) ^ ROTR(v[4], 11) ^ ROTR(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + digest_rounds[i] + w[i];
+		t2 = (ROTR(v[0], 2) ^ ROTR(v[0], 13) ^ ROTR(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		memmove(v + 1, v, 7 * sizeof(unsigned int));
+		v[4] += t1;
+		v[0] = t1 + t2;
 	}
+	for (i = 0; i < 8; i++)
+		d->state[i] += v[i];
+}
 
-	fseek(inputFile, 0L, SEEK_END);									/* Find size of input file in bytes.				*/
-	file_size = ftell(inputFile);									/*													*/
-	fseek(inputFile, 0L, SEEK_SET);									/* Rewind file.									 	*/
-	/*************************ROUND DATA ARRAY SIZE TO LOWEST POWER OF TWO LARGER THAN FILE SIZE*************************/
-	bytes_alloc = file_size;										/* Initialize bytes_alloc with the file_size value. */
+#undef ROTR
 
-	while ((bytes_alloc >> 1) != 0)									/* Determine leftmost '1' bit of file size.		 	*/
-	{																/*													*/
-		bytes_alloc >>= 1;											/* Shift right until the next shift zeroes it.		*/
-		shift++;													/* Keep track of shifts.							*/
-	}																/*													*/
-	bytes_alloc <<= shift; 											/* Unshift. 										*/
-	if (file_size != bytes_alloc)									/* If not a power of two, round up.					*/
-		bytes_alloc <<= 1;
-	(dao->prg_allocbits) = bytes_alloc * 8;							/* Set literal allocation bit size.				 	*/
-	/********************************************************************************************************************/
+static void digest_init(Digest* d)
+{
+	static const unsigned int start[8] = \
+		{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	memcpy(d->state, start, sizeof(start));
+	d->length = 0;
+	d->used = 0;
+}
 
-	verbosely printf("%s%s.\nLoading data:\n", "Running ", inputFileName);
+static void digest_add(Digest* d, const unsigned char* bytes, size_t count)
+{
+	size_t take;
+	d->length += count;
+	while (count)
+	{
+		take = (64 - d->used < count) ? 64 - d->used : count;
+		memcpy(d->block + d->used, bytes, take);
+		d->used += (unsigned int)take;
+		bytes += take;
+		count -= take;
+		if (d->used == 64)
+		{
+			digest_block(d, d->block);
+			d->used = 0;
+		}
+	}
+}
 
-	if (bytes_alloc % sizeof(unsigned long) != 0)					/* Only occurs if it's less than one UL, one cell   */
-		bytes_alloc = sizeof(unsigned long);						/* Set the minimum									*/
+static void digest_end(Digest* d, unsigned char* out)
+{
+	unsigned long long bits = d->length * BITS_IN_BYTE;
+	unsigned char pad = 0x80;
+	int i;
+	digest_add(d, &pad, 1);
+	pad = 0;
+	while (d->used != 56)
+		digest_add(d, &pad, 1);
+	for (i = 7; i >= 0; i--)
+	{
+		pad = (unsigned char)(bits >> (8 * i));
+		digest_add(d, &pad, 1);
+	}
+	for (i = 0; i < 32; i++)
+		out[i] = (unsigned char)(d->state[i / 4] >> (24 - 8 * (i % 4)));
+}
+#endif
 
-	if (((dao->prg_data) = calloc(bytes_alloc, 1)) == NULL)			/* Allocate data array to bytes needed.				*/
+/*
+* The compile cache keeps compiled code under the FNV-1a hash and length of the source and
+* the front-end that read it. A hash can collide, by chance or on purpose, so each entry
+* begins with the SHA-256 of the same bytes, and a hit whose digest differs is a miss.
+* Entries are written under a name of their own and renamed into place, so processes sharing the
+* directory only ever see whole files. A hit touches its entry, and a store removes the
+* least recently used entries while the directory is over DAO_CACHE_MAX bytes.
+*/
+static int compile_cached(Dao_vm* vm, FILE* input, char* entry, unsigned char* digest)
+{
+#if defined(_WIN32)
+	return 0;
+#else
+	unsigned char block[COMPILE_BYTES];
+	unsigned long long hash = 14695981039346656037ULL, length = 0;
+	const char* dir = getenv("DAO_CACHE");
+	const char* home = getenv("HOME");
+	unsigned char front = HEX_SOURCE ? 'x' : 's';
+	size_t got, i;
+	struct stat st;
+	Digest d;
+	if (fstat(fileno(input), &st) != 0 || !S_ISREG(st.st_mode))		/* Pipes and the like are read only once		*/
+		return 0;
+	if (dir == NULL || !*dir)										/* ~/.cache/dao unless told otherwise			*/
 	{
-		printf("Error allocating %d bytes: ", bytes_alloc);
+		if (home == NULL || snprintf(entry, CACHE_PATH, "%s/.cache", home) >= CACHE_PATH)
+			return 0;
+		mkdir(entry, 0755);
+		strcat(entry, "/dao");
+	}
+	else if (snprintf(entry, CACHE_PATH, "%s", dir) >= CACHE_PATH - 64)
+		return 0;
+	if (mkdir(entry, 0755) != 0 && errno != EEXIST)
+		return 0;
+	hash = (hash ^ front) * 1099511628211ULL;
+	digest_init(&d);
+	digest_add(&d, &front, 1);
+	while ((got = fread(block, 1, COMPILE_BYTES, input)) > 0)
+	{
+		digest_add(&d, block, got);
+		for (i = 0; i < got; i++)
+			hash = (hash ^ block[i]) * 1099511628211ULL;
+		length += got;
+	}
+	if (ferror(input) || fseek(input, 0L, SEEK_SET) != 0)			/* The compiler reads it again on a miss		*/
+	{
+		printf("Error reading source again: ");					/* What it has read is gone						*/
 		perror("");
 		abort();
 	}
-	verbosely printf("Allocated %d bytes for %d byte file.\n", bytes_alloc, file_size);
+	digest_end(&d, digest);
+	sprintf(entry + strlen(entry), "/%016llx-%llx" FILE_COMPILED, hash, length);
+	return 1;
+#endif
+}
+
+static int cache_load(Dao_vm* vm, const char* entry, const unsigned char* digest)
+{
+#if defined(_WIN32)
+	return 0;
+#else
+	unsigned char block[COMPILE_BYTES];
+	FILE* cached = fopen(entry, "rb");
+	size_t got;
+	if (cached == NULL)
+		return 0;
+	if (fread(block, 1, CACHE_DIGEST, cached) != CACHE_DIGEST || memcmp(block, digest, CACHE_DIGEST) != 0)
+	{
+		fclose(cached);												/* Another source with the same name			*/
+		return 0;
+	}
+	vm -> compiled_size = 0;
+	compile_emit(vm, NULL, block, 0);
+	while ((got = fread(block, 1, COMPILE_BYTES, cached)) > 0)
+		compile_emit(vm, NULL, block, got);
+	got = !ferror(cached);
+	fclose(cached);
+	if (got)
+		utime(entry, NULL);											/* Recently used, so removed last				*/
+	return (int)got;
+#endif
+}
 
-	bytes_read = fread((dao->prg_data), 1, file_size, inputFile);
+static void cache_store(Dao_vm* vm, const char* entry, const unsigned char* digest)
+{
+#if !defined(_WIN32)
+	char temp[CACHE_PATH + 32];
+	const char* name = strrchr(entry, '/') + 1;
+	FILE* output;
+	int fine;
+	sprintf(temp, "%.*s.%s.%ld", (int)(name - entry), entry, name, (long)getpid());
+	if ((output = fopen(temp, "wb")) == NULL)
+		return;
+	fine = fwrite(digest, 1, CACHE_DIGEST, output) == CACHE_DIGEST;
+	fine = fwrite(vm -> compiled, 1, vm -> compiled_size, output) == vm -> compiled_size && fine;
+	fine = (fclose(output) == 0) && fine;
+	if (!fine || rename(temp, entry) != 0)
+		unlink(temp);
+	else
+		cache_trim(entry, name);
+#endif
+}
 
-	verbosely printf("Read %d bytes.\n\n", bytes_read);				/* Read file data into data array.					*/
+#if !defined(_WIN32)
+static int cache_older(const void* a, const void* b)
+{
+	time_t x = ((const Cached*)a)->used, y = ((const Cached*)b)->used;
+	return (x > y) - (x < y);
+}
+#endif
 
-	while (print_index++ < (bytes_alloc / sizeof(unsigned long)))	/* Traverse the array, and...						*/
+static void cache_trim(const char* entry, const char* name)
+{
+#if !defined(_WIN32)
+	char dir[CACHE_PATH], path[CACHE_PATH + 256];
+	const char* cap = getenv("DAO_CACHE_MAX");
+	unsigned long long limit = (cap != NULL && *cap) ? strtoull(cap, NULL, 10) : CACHE_MAX, total = 0;
+	Cached* entries = NULL;
+	size_t count = 0, alloc = 0, i;
+	struct dirent* found;
+	struct stat st;
+	DIR* listing;
+	sprintf(dir, "%.*s", (int)(name - entry - 1), entry);
+	if ((listing = opendir(dir)) == NULL)
+		return;
+	while ((found = readdir(listing)) != NULL)
+	{
+		size_t length = strlen(found->d_name);
+		if (found->d_name[0] == '.' || length < sizeof(FILE_COMPILED) || strcmp(found->d_name + length - sizeof(FILE_COMPILED) + 1, FILE_COMPILED))
+			continue;												/* Only whole entries, never another's temporary	*/
+		snprintf(path, sizeof(path), "%s/%s", dir, found->d_name);
+		if (stat(path, &st) != 0)
+			continue;
+		if (count == alloc)
+		{
+			Cached* grown = realloc(entries, (alloc = alloc ? alloc * 2 : 64) * sizeof(Cached));
+			if (grown == NULL)
+				break;
+			entries = grown;
+		}
+		entries[count].used = st.st_mtime;
+		entries[count].bytes = st.st_size;
+		if ((entries[count].name = str_dup(found->d_name)) == NULL)
+			break;
+		total += st.st_size;
+		count++;
+	}
+	closedir(listing);
+	if (total > limit)
 	{
-		flip_UL((dao->prg_data) + print_index - 1);					/* Flip the byte order to the correct one 			*/
-		verbosely
+		qsort(entries, count, sizeof(Cached), cache_older);
+		for (i = 0; i < count && total > limit; i++)
 		{
-			printf("%s   ", l_to_str((dao->prg_data)[print_index - 1], 8, 16, 0));/* If verbose, print out array contents*/
-		if (print_index % 8 == 0) printf("\n");						/* New line every seven unsigned longs.				*/
+			if (!strcmp(entries[i].name, name))						/* Keep what was just stored					*/
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+			if (unlink(path) == 0)
+				total -= entries[i].bytes;
 		}
 	}
+	for (i = 0; i < count; i++)
+		free(entries[i].name);
+	free(entries);
+#endif
+}
+
+/*
+* With -j, a large source file is mapped and cut into one chunk per core, and compiled in
+* two parallel passes. The first counts each chunk's symbols as if it began outside a
+* comment, noting how many come before its first line end and whether it ends inside a
+* comment. A walk over the counts then gives every chunk the comment state and nybble
+* offset it really starts at. The second pass compiles each chunk straight into its place
+* in the output. A chunk starting at an odd nybble writes the byte it shares with the one
+* before, and a chunk ending on half a byte leaves that half to be merged after the join.
+*/
+#if defined(__GNUC__)
+#define bit_count(m)	((size_t)__builtin_popcountll(m))
+#else
+static size_t bit_count(unsigned long long m)
+{
+	size_t n = 0;
+	for (; m != 0; m &= m - 1)
+		n++;
+	return n;
+}
+#endif
+
+static void* compile_count(void* arg)
+{
+	Chunk* chunk = arg;
+	unsigned long long space, at, line, code;
+	unsigned char isComment = 0;
+	unsigned int count;
+	size_t i;
+	for (i = 0; i < chunk->bytes; i += 64)
+	{
+		count = (chunk->bytes - i < 64) ? (unsigned int)(chunk->bytes - i) : 64;
+		compile_masks(chunk->src + i, count, &space, &at, &line);
+		code = ~(space | at | line | compile_comments(at, line, &isComment));
+		if (count < 64)
+			code &= (1ULL << count) - 1;
+		chunk->code += bit_count(code);
+		if (!chunk->lined)
+		{
+			chunk->lead += bit_count(line ? code & ((1ULL << bit_first(line)) - 1) : code);
+			chunk->lined = line != 0;
+		}
+	}
+	chunk->opens = isComment;
+	return NULL;
+}
+
+static void* compile_chunk(void* arg)
+{
+	Chunk* chunk = arg;
+	size_t i;
+	for (i = 0; i < chunk->bytes; i += 64)
+		compile_block(&chunk->state, chunk->src + i, (chunk->bytes - i < 64) ? (unsigned int)(chunk->bytes - i) : 64);
+	return NULL;
+}
+
+#if !defined(_WIN32)
+static void compile_parallel(Chunk* chunks, unsigned int count, void* (*pass)(void*))
+{
+	pthread_t threads[COMPILE_THREADS];
+	char started[COMPILE_THREADS];
+	unsigned int t;
+	for (t = 0; t < count; t++)
+		if (!(started[t] = pthread_create(&threads[t], NULL, pass, &chunks[t]) == 0))
+			pass(&chunks[t]);												/* No thread: do it here			*/
+	for (t = 0; t < count; t++)
+		if (started[t])
+			pthread_join(threads[t], NULL);
+}
+#endif
+
+static int compile_split(Dao_vm* vm, FILE* input, FILE* output, const unsigned char* nybbles)
+{
+#if defined(_WIN32)
+	return 0;
+#else
+	Chunk chunks[COMPILE_THREADS];
+	struct stat st;
+	unsigned char* src;
+	unsigned char* out;
+	unsigned char isComment = 0;
+	size_t bytes, per, nybble = 0;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int count, t;
+	if (input == stdin || fstat(fileno(input), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 2 * COMPILE_CHUNK || cores < 2)
+		return 0;
+	bytes = (size_t)st.st_size;
+	count = (bytes / COMPILE_CHUNK < (size_t)cores) ? (unsigned int)(bytes / COMPILE_CHUNK) : (unsigned int)cores;
+	if (count > COMPILE_THREADS)
+		count = COMPILE_THREADS;
+	if ((src = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fileno(input), 0)) == MAP_FAILED)
+		return 0;
+	per = (bytes / count + 63) & ~(size_t)63;								/* Chunks meet on 64-byte blocks	*/
+	for (t = 0; t < count; t++)
+	{
+		memset(&chunks[t], 0, sizeof(Chunk));
+		chunks[t].src = src + per * t;
+		chunks[t].bytes = (t + 1 < count) ? per : bytes - per * t;
+	}
+	compile_parallel(chunks, count, compile_count);
+	for (t = 0; t < count; t++)
+	{
+		chunks[t].start = nybble;
+		chunks[t].state.isComment = isComment;
+		nybble += isComment ? chunks[t].code - chunks[t].lead : chunks[t].code;
+		isComment = chunks[t].lined ? chunks[t].opens : (isComment || chunks[t].opens);
+	}
+	if ((out = calloc((nybble + 1) / 2 + 1, 1)) == NULL)
+	{
+		munmap(src, bytes);
+		return 0;
+	}
+	for (t = 0; t < count; t++)
+	{
+		chunks[t].state.nybbles = nybbles;
+		chunks[t].state.vm = vm;
+		chunks[t].state.out = out + chunks[t].start / 2;
+		chunks[t].state.emptyBuffer = !(chunks[t].start & 1);
+	}
+	compile_parallel(chunks, count, compile_chunk);
+	for (t = 0; t < count; t++)
+		if (!chunks[t].state.emptyBuffer)
+			chunks[t].state.out[chunks[t].state.used] |= chunks[t].state.toWrite;	/* High half of a shared byte	*/
+	compile_emit(vm, output, out, (nybble + 1) / 2);
+	free(out);
+	munmap(src, bytes);
+	return 1;
+#endif
+}
+#endif
+
+#define rc(r,c) case c: return r;
+
+static unsigned char getNybble(char ch)
+{
+	switch (ch)
+	{
+		rc(0x0, '.')	rc(0x1, '!')	rc(0x2, '/')	rc(0x3, ']': case ')')
+		rc(0x4, '%')	rc(0x5, '#')	rc(0x6, '>')	rc(0x7, '=')
+		rc(0x8, '(')	rc(0x9, '<')	rc(0xA, ':')	rc(0xB, 'S')
+		rc(0xC, '[')	rc(0xD, '*')	rc(0xE, '$')	rc(0xF, ';')
+		default: return 0x0;
+	}
+}
+
+static unsigned char getHexNybble(char ch)
+{
+	const char* digits = "0123456789ABCDEF";
+	const char* at = strchr(digits, ch);
+	return (ch != 0 && at != NULL) ? (unsigned char)(at - digits) : 0x0;
+}
+
+/***
+ *    ooooo ooooo      ooo ooooooooooooo oooooooooooo ooooooooo.   ooooooooo.   ooooooooo.   oooooooooooo ooooooooooooo 
+ *    `888' `888b.     `8' 8'   888   `8 `888'     `8 `888   `Y88. `888   `Y88. `888   `Y88. `888'     `8 8'   888   `8 
+ *     888   8 `88b.    8       888       888          888   .d88'  888   .d88'  888   .d88'  888              888      
+ *     888   8   `88b.  8       888       888oooo8     888ooo88P'   888ooo88P'   888ooo88P'   888oooo8         888      
+ *     888   8     `88b.8       888       888    "     888`88b.     888          888`88b.     888    "         888      
+ *     888   8       `888       888       888       o  888  `88b.   888          888  `88b.   888       o      888      
+ *    o888o o8o        `8      o888o     o888ooooood8 o888o  o888o o888o        o888o  o888o o888ooooood8     o888o     
+ *                                                                                                                      
+ *                                                                                                                      
+ *                                                                                                                      
+ */
+
+#if !defined(DAO_LIBRARY)
+static void interpret(Dao_vm* vm, char* inputFileName, const unsigned char* image, size_t image_size)
+{
+	if (interpret_load(vm, inputFileName, image, image_size))
+	{
+		run(vm, 0);
+		interpret_end(vm);
+	}
+}
+#endif
+
+/*
+* Makes compiled code the top-level program of vm and enters it, ready for run(). The code
+* comes from image, or from the file inputFileName when image is NULL. Returns 0 if there
+* was no such file.
+*/
+static int interpret_load(Dao_vm* vm, char* inputFileName, const unsigned char* image, size_t image_size)
+{
+	FILE* inputFile = (image == NULL) ? fopen(inputFileName, "rb") : NULL;	/* Compiled code comes from memory or a file */
+	unsigned long bytes_read = 0;	
+
+	/*************************                           RUN THE CODE                           *************************/
+	unsigned long 	print_index = 0;								/* Index for printing                               */
+	unsigned long	bytes_alloc = 0;								/* Bytes allocated to data                          */
+	unsigned long	file_size = 0;									/* Byte size of file 								*/
+	unsigned long	shift = 0;										/* Shift for first one of file size for rounding    */
+
+	Path dao = &vm -> root;											/* The top-level PATH lives in the VM.				*/
+
+	verbosely
+	{
+		printf("\n\n\t=====================\n"  );
+		printf(    "\t|Beginning Execution|\n"  );
+		printf(    "\t=====================\n\n");
+	}
+
+	if (inputFile == NULL && image == NULL)
+	{
+		printf("Could not find \"%s\" - is it in this directory?\n", inputFileName);
+		return 0;
+	}
+	*dao = NEW_PATH;												/* Initialize it with the initialization values.	*/
+	if (image != NULL)
+		file_size = image_size;
+	else
+	{
+		fseek(inputFile, 0L, SEEK_END);								/* Find size of input file in bytes.				*/
+		file_size = ftell(inputFile);								/*													*/
+		fseek(inputFile, 0L, SEEK_SET);								/* Rewind file.									 	*/
+	}
+	/*************************ROUND DATA ARRAY SIZE TO LOWEST POWER OF TWO LARGER THAN FILE SIZE*************************/
+	bytes_alloc = file_size;										/* Initialize bytes_alloc with the file_size value. */
+
+	while ((bytes_alloc >> 1) != 0)									/* Determine leftmost '1' bit of file size.		 	*/
+	{																/*													*/
+		bytes_alloc >>= 1;											/* Shift right until the next shift zeroes it.		*/
+		shift++;													/* Keep track of shifts.							*/
+	}																/*													*/
+	bytes_alloc <<= shift; 											/* Unshift. 										*/
+	if (file_size != bytes_alloc)									/* If not a power of two, round up.					*/
+		bytes_alloc <<= 1;
+	(dao->prg_allocbits) = bytes_alloc * 8;							/* Set literal allocation bit size.				 	*/
+	/********************************************************************************************************************/
+
+	verbosely printf("%s%s.\nLoading data:\n", "Running ", inputFileName);
+
+	if (bytes_alloc % sizeof(Cell) != 0)							/* Only occurs if it's less than one cell			*/
+		bytes_alloc = sizeof(Cell);									/* Set the minimum									*/
+
+	if (image == NULL && tape_bytes(bytes_alloc * 8) >= TAPE_MAP_MIN && tape_load(vm, dao, inputFile, file_size))
+		bytes_read = file_size;										/* Large images are mapped, not read				*/
+	else if (tape_alloc(vm, dao, bytes_alloc * 8) == NULL)			/* Allocate data array to bytes needed.				*/
+	{
+		printf("Error allocating %lu bytes: ", bytes_alloc);
+		perror("");
+		abort();
+	}
+	else if (image != NULL)
+		memcpy(dao->prg_data, image, bytes_read = file_size);
+	else
+		bytes_read = fread((dao->prg_data), 1, file_size, inputFile);
+	if (inputFile != NULL)
+		fclose(inputFile);
+	verbosely printf("Allocated %lu bytes for %lu byte file.\n", bytes_alloc, file_size);
+	verbosely printf("Read %lu bytes.\n\n", bytes_read);				/* Read file data into data array.					*/
+
+	verbosely
+	{
+		for (print_index = 0; print_index * BITS_IN_WORD < (dao->prg_allocbits); )
+		{
+			printf("%s   ", l_to_str(vm, read_by_bit_index(dao, print_index * BITS_IN_WORD, BITS_IN_WORD), 8, 16, 0));
+			if (++print_index % 8 == 0) printf("\n");				/* If verbose, print out array contents, eight words a line */
+		}
+	}
+
+	verbosely printf("(%lu bytes)\n\n", (dao->prg_allocbits) / 8);	/* If verbose, output number of bytes.				*/
+	P_RUNNING = NULL;												/* Nothing is running above the top level			*/
+	vm -> out_lines = FLUSH_LINES || (vm -> write == NULL && isatty(fileno(stdout)));	/* Terminals see output a line at a time */
+	vm -> root_bytes = bytes_alloc;
 
-	verbosely printf("(%d bytes)\n\n", (dao->prg_allocbits) / 8);	/* If verbose, output number of bytes.				*/
-	P_RUNNING = dao;												/* For the sake of levlim							*/
-	
 	/***************************************************** EXECUTE ******************************************************/
-	execs(dao, NULL);
-	verbosely printf("Freeing %d bytes of data.\n", bytes_alloc);
-	free((dao->prg_data));
+	execs(vm, dao);
+	return 1;
+}
+
+/* Ends the top-level program, wherever it is, and frees everything it had. */
+static void interpret_end(Dao_vm* vm)
+{
+	Path dao = &vm -> root;
+	out_flush(vm);
+	verbosely printf("Freeing %lu bytes of data.\n", vm -> root_bytes);
+	verbosely printf("Reused %lu of %lu paths and %lu of %lu tapes.\n", vm -> pool.path_hits, vm -> pool.path_hits + vm -> pool.path_misses,
+		vm -> pool.tape_hits, vm -> pool.tape_hits + vm -> pool.tape_misses);
+	verbosely if (MEMO) printf("Recalled %lu of %lu pure EXECS.\n", vm -> memo_hits, vm -> memo_hits + vm -> memo_misses);
+	pool_reset(vm);													/* Every path and tape goes with the arena			*/
 	(dao -> prg_data) = NULL;
+	(dao -> prg_pages) = NULL;
+	(dao -> prg_tree) = NULL;
+	vm -> root_bytes = 0;
+	vm -> frame_count = 0;											/* A program stopped early is over too				*/
+	vm -> ran = 0;
+	P_RUNNING = P_WRITTEN = NULL;
+	OPS = functions[0];
+	vm -> doloop = 1;
 	verbprint("Data freed.\n")
 	/********************************************************************************************************************/
 
@@ -334,12 +1478,15 @@ static void interpret(char* inputFileName)
 
 #define arg_is(i, a) (!strcmp(parsed[i], a))
 
+#if !defined(DAO_LIBRARY)
 static unsigned char hasExtension(char*);
 static int  		 parsePosInt(char*, unsigned int);
-static void 		 rad_print(Path, unsigned int);
-static void			 flag(char**, int);
+static void 		 rad_print(Dao_vm*, Path, unsigned int);
+static void			 flag(Dao_vm*, char**, int);
+#endif
 
-static void prompt()
+#if !defined(DAO_LIBRARY)
+static void prompt(Dao_vm* vm)
 {
 	int ac;
 	unsigned char prompting = 1;
@@ -413,7 +1560,7 @@ static void prompt()
 			}
 			/*************************************************** FLAG OPTION CASE ***************************************************/
 			else if (arg_is(0, "flag") || arg_is(0, "flags") || arg_is(0, "f"))
-				flag(parsed, ac);
+				flag(vm, parsed, ac);
 			/***************************************************  RUN OPTION CASE ***************************************************/
 			else if (arg_is(0, "run") || arg_is(0, "r"))
 			{
@@ -430,42 +1577,34 @@ static void prompt()
 						if ((inputFile = fopen(exeName, "rb")) != NULL)
 						{
 							fclose(inputFile);
-							interpret(exeName);
+							interpret(vm, exeName, NULL, 0);
 						}
 						else
 						{
 							daoName = strncat(daoName, FILE_SYMBOLIC, sizeof(FILE_SYMBOLIC));
 							if ((inputFile = fopen(daoName, "rb")) != NULL)
-							{
-								FILE* outputFile = fopen(exeName, "wb+");
-								compile(inputFile, outputFile, exeName);
-								interpret(fileName);
-							}
+								compile_run(vm, inputFile, exeName);
 							else
-							{
 								printf("Could not find \"%s\" - is it in this directory?\n", parsed[1]);
-								fclose(inputFile);
-							}
 						}
 					}
 					else if ((inputFile = fopen(fileName, "rb")) != NULL)
 					{
 						if (~strcmp(FILE_SYMBOLIC, &fileName[strlen(fileName) - 4]))
 						{
-							FILE* outputFile = NULL;
 							fileName[strlen(fileName) - 4] = 0;
 							fileName = strncat(fileName, FILE_COMPILED, sizeof(FILE_COMPILED));
-							outputFile = fopen(fileName, "wb+");
-							compile(inputFile, outputFile, fileName);
+							compile_run(vm, inputFile, fileName);
+						}
+						else
+						{
+							fclose(inputFile);
+							if (FORCE || ~strcmp(FILE_COMPILED, &fileName[strlen(fileName) - 6]))
+								interpret(vm, fileName, NULL, 0);
 						}
-						if (FORCE || ~strcmp(FILE_COMPILED, &fileName[strlen(fileName) - 6]))
-							interpret(fileName);
 					}
 					else
-					{
 						printf("Could not find \"%s\" - is it in this directory?\n", fileName);
-						fclose(inputFile);
-					}
 				}
 				else
 					printf("Please input a filename to run.\n");
@@ -489,8 +1628,14 @@ static void prompt()
 						if (!FORCE)												/* If not forcing, truncate .dao to add .wuwei	*/
 							fileName[strlen(fileName) - 4] = 0;
 						fileName = strncat(fileName, FILE_COMPILED, sizeof(FILE_COMPILED));	/* Add .wuwei for output file 		*/
-						outputFile = fopen(fileName, "wb+");								/* Open output file 				*/
-						compile(inputFile, outputFile, fileName);
+						if ((outputFile = fopen(fileName, "wb+")) == NULL)				/* Open output file 				*/
+						{
+							printf("Could not write \"%s\": ", fileName);
+							perror("");
+							fclose(inputFile);
+						}
+						else
+							compile(vm, inputFile, outputFile, fileName);
 					}
 					else
 					{
@@ -514,25 +1659,21 @@ static void prompt()
 				printf("\tIt is also impractical to retrieve stored programs through this mode.\n");
 
 				P_RUNNING = TLP;												/* Set running 										*/
+				OPS = functions[TLP -> prg_level];								/* Use its level's dispatch table					*/
 
-				if (((TLP -> child) = (calloc(1, sizeof(struct PATH)))) == NULL)/* Allocate memory space 							*/
+				if (((TLP -> child) = path_new(vm, TLP)) == NULL)				/* Allocate memory space 							*/
 				{																/* Cover error case							 		*/
 					printf("FATAL ERROR: Unable to allocate memory.");
 					return;
 				}
 
 				verbosely printf("Allocated %d bytes.\n\n", sizeof(*(TLP -> child)));
-
-				memcpy((TLP -> child), &NEW_PATH, sizeof(struct PATH));			/* Copy over initialization data			 		*/
-				((TLP -> child) -> owner) = TLP;								/* Set owner of this new Path 						*/
-				((TLP -> child) -> prg_floor) = (TLP -> prg_floor) + 1;			/* Set floor of this new Path 						*/
-				((TLP -> child) -> prg_data) = calloc(1, sizeof(unsigned long));/* Set data  of this new Path 						*/
 				P_WRITTEN = (TLP -> child);										/* Set this as written on 							*/
 
 				(TLP -> prg_allocbits) = BITS_IN_CELL;
-				if (((TLP->prg_data) = calloc(DEFAULT_INTERPRET_CELL_LENGTH, sizeof(unsigned long))) == NULL)	/* Allocate data space 	*/
+				if (tape_alloc(vm, TLP, DEFAULT_INTERPRET_CELL_LENGTH * BITS_IN_CELL) == NULL)	/* Allocate data space 			*/
 				{
-					printf("Error allocating %d bytes", DEFAULT_INTERPRET_CELL_LENGTH * sizeof(unsigned long));
+					printf("Error allocating %d bytes", (int)(DEFAULT_INTERPRET_CELL_LENGTH * sizeof(Cell)));
 					perror("");
 					return;
 				}
@@ -582,7 +1723,7 @@ static void prompt()
 							if (arg_is(0, "~end") || arg_is(0, "~quit") || arg_is(0, "~q") || arg_is(0, "~kill") || arg_is(0, "~exit"))
 								activeinterpret = 0;
 							else if (arg_is(0, "~flag") || arg_is(0, "~flags") || arg_is(0, "~f"))
-								flag(parsed, ac);
+								flag(vm, parsed, ac);
 							else if (arg_is(0, "~print") || arg_is(0, "~what") || arg_is(0, "~show"))
 							{
 								/* Check if there is a keyword combination and then check for an indication of base. */
@@ -632,7 +1773,7 @@ static void prompt()
 									if (base == 0)
 										base = ((TLP -> prg_allocbits) > 32) ? 16 : 2;
 									/* Then with base set, we can go and print accordingly */
-									rad_print(pathToPrint, (unsigned int)base);
+									rad_print(vm, pathToPrint, (unsigned int)base);
 									putchar('\n');
 								}
 								else
@@ -651,29 +1792,28 @@ static void prompt()
 								/* For each character */
 								for (j = 0, lim = strlen(parsed[i]); j < lim; j++)
 								{
-									command = getNybble(parsed[i][j]);
+									vm -> command = getNybble(parsed[i][j]);
 									/* Insert parsed symbol into the Top level program */
-									write_by_bit_index(TLP, (TLP -> prg_index), 4, command);
+									write_by_bit_index(vm, TLP, (TLP -> prg_index), 4, vm -> command);
 									/* Increase size if necessary */
 									if ((TLP -> prg_index) > (TLP -> prg_allocbits))
-										doalc(TLP);
+										doalc(vm, TLP);
 
 									/* DEALC condition through this is a problem. */
 
-									if (command == 5)
-										execs(P_WRITTEN, P_RUNNING);
-									else if (command != 0)
-										functions[command](P_WRITTEN);
+									OPS[vm -> command](vm, P_WRITTEN);
+									run(vm, 0);
+									out_flush(vm);								/* What it READS shows before the next prompt		*/
 
-									if (doloop)
+									if (vm -> doloop)
 									{
-										verbosely diagnose(P_RUNNING, command);
+										verbosely diagnose(vm, P_RUNNING, vm -> command);
 										verbprint("\n")
 									}
 									else
 									{
 										verbosely printf("Freed %d bytes.\n\n", sizeof(*P_WRITTEN));
-										free(P_WRITTEN);
+										path_free(vm, P_WRITTEN);
 									}
 								}
 							}
@@ -682,7 +1822,7 @@ static void prompt()
 					freeparsedargs(parsed);
 				}
 				/* Deallocate the paths involved to avoid a memory leak!! */
-				free((TLP -> child));
+				pool_reset(vm);
 			}
 			/************************************************** INVALID OPTION CASE *************************************************/
 			else printf("%s is not a recognized or valid option.\n", parsed[0]);
@@ -691,7 +1831,7 @@ static void prompt()
 	freeparsedargs(parsed);
 }
 
-static void	flag(char** parsed, int ac)
+static void	flag(Dao_vm* vm, char** parsed, int ac)
 {
 	int i = 1;
 	/* We want the format: -flag ON/OFF */
@@ -703,7 +1843,7 @@ static void	flag(char** parsed, int ac)
 			{
 				if (arg_is(i, "ON") || arg_is(i, "OFF")) 										/* Next input is correct form   */
 				{
-					set_option(parsed[i-1], strcmp(parsed[i], "OFF")); 							/* Set option correctly. 		*/
+					set_option(vm, parsed[i-1], strcmp(parsed[i], "OFF")); 							/* Set option correctly. 		*/
 					printf("Set option -%c to %d.\n", parsed[i-1][1], strcmp(parsed[i], "OFF"));
 				}
 				else																  			/* Incorrect form 				*/
@@ -768,7 +1908,7 @@ static int setargs(char *args, char **argv)
 	return count;
 }
 
-char **parsedargs(char *args, int *argc)
+static char **parsedargs(char *args, int *argc)
 {
 	char **argv = NULL;
 	int	argn = 0;
@@ -789,7 +1929,7 @@ char **parsedargs(char *args, int *argc)
 	return argv;
 }
 
-void freeparsedargs(char **argv)
+static void freeparsedargs(char **argv)
 {
 	if (argv)
 	{
@@ -797,6 +1937,7 @@ void freeparsedargs(char **argv)
 		free(argv-1);
 	} 
 }
+#endif
 
 /***
  *    oooooooooooo ooooooooooooo   .oooooo.   
@@ -813,7 +1954,7 @@ void freeparsedargs(char **argv)
 
 #define roc(o,v,c) case o:c=v; return &c;
 
-char* set_option(char* str, char value)
+static char* set_option(Dao_vm* vm, char* str, char value)
 {
 	if (is_option(str))
 		switch (str[1])
@@ -825,20 +1966,41 @@ char* set_option(char* str, char value)
 		roc('d', value, PRINT_CODE)
 		roc('s', value, SKIP_OVERFLOW)
 		roc('p', value, PRINT_EVERYTHING)
+		roc('t', value, THREADED)
+		roc('z', value, SPARSE)
+		roc('b', value, TREE)
+		roc('m', value, MEMO)
+		roc('l', value, FLUSH_LINES)
+		roc('r', value, FLUSH_READS)
+		roc('x', value, HEX_SOURCE)
+		roc('j', value, SPLIT_COMPILE)
+		roc('n', value, NO_WUWEI)
+		roc('k', value, CACHE)
 		default:
 			printf("Unknown option -%c.\n\n", str[1]);
 		}
 	return NULL;
 }
 
+#if !defined(DAO_LIBRARY)
 static void flags()
 {
 	printf("\t-c : Compile without running\n");
+	printf("\t-x : Compile source written in hex digits 0-9 and A-F instead of symbols\n");
+	printf("\t-j : Compile large source files in chunks on every core\n");
+	printf("\t-n : Run sources from memory without writing the compiled file\n");
+	printf("\t-k : Keep compiled code in a cache by source, and reuse it (DAO_CACHE names the directory, DAO_CACHE_MAX its size)\n");
 	printf("\t-d : Print code instead of numeric values.\n");
 	printf("\t-v : Enable Verbose Execution (For Debugging)\n");
 	printf("\t-w : Get Input before closing (For Debugging)\n");
 	printf("\t-f : Force Execution of Any FILE* as COMPILED DAOYU (DANGEROUS)\n");
 	printf("\t-p : Print all data in every 32 tetrad line, even if all zeroes.\n");
+	printf("\t-t : Pre-decode running programs and dispatch them threaded (Faster for long-running loops)\n");
+	printf("\t-z : Keep large tapes as page tables, so untouched pages cost nothing (For huge, mostly empty allocations)\n");
+	printf("\t-b : Keep tapes as shared binary trees, so SWAPS and SPLIT move pointers instead of data (For large selections)\n");
+	printf("\t-m : Remember the results of EXECS that do no I/O, and reuse them on the same program and data\n");
+	printf("\t-l : Write out program output at every newline (The default when output is a terminal)\n");
+	printf("\t-r : Write out program output after every READS, instead of a buffer at a time\n");
 	printf("\t-s : When attempting to allocate more memory than is supported, skip the command instead of aborting. (NOT RECOMMENDED)\n");
 	printf("\t-h : Do not print the data of the written file when using Verbose Execution (For excessively large programs)\n\n");
 }
@@ -876,433 +2038,2424 @@ static void splash()
 	flags();
 	putchar('\n');
 }
+#endif
+
+static char *str_dup (char *s) {
+    char *d = malloc (strlen (s) + 1);   /*Allocate memory			*/
+    if (d != NULL) strcpy (d,s);         /*Copy string if okay		*/
+    return d;                            /*Return new memory		*/
+}
+
+static char* bin(Dao_vm* vm, unsigned long val) { return l_to_str(vm, val, 32, 2, 1); }
+
+static char getChar(unsigned char ch)
+{
+	if (ch > 0xF) return '?';
+	return symbols[ch];
+}
+
+static char* l_to_str(Dao_vm* vm, unsigned long val, unsigned char len, unsigned char radix, unsigned char override_num_only)
+{
+	char* buf = vm -> digits;
+	int i = 33;
+	for (; val && i; --i, val /= radix)
+		buf[i] = ((PRINT_CODE && !override_num_only) ? ".!/)%#>=(<:S[*$;????????????????" : "0123456789ABCDEFGHIJKLMNOPQRSTUV")[val % radix];
+	for (; i; i--)
+		buf[i] = (PRINT_CODE && !override_num_only) ? '.' : '0';
+	return &buf[2 + (32 - len)];
+}
+
+/***
+ *     .oooooo..o oooooo   oooo ooo        ooooo oooooooooo.    .oooooo.   ooooo         .oooooo..o 
+ *    d8P'    `Y8  `888.   .8'  `88.       .888' `888'   `Y8b  d8P'  `Y8b  `888'        d8P'    `Y8 
+ *    Y88bo.        `888. .8'    888b     d'888   888     888 888      888  888         Y88bo.      
+ *     `"Y8888o.     `888.8'     8 Y88. .P  888   888oooo888' 888      888  888          `"Y8888o.  
+ *         `"Y88b     `888'      8  `888'   888   888    `88b 888      888  888              `"Y88b 
+ *    oo     .d8P      888       8    Y     888   888    .88P `88b    d88'  888       o oo     .d8P 
+ *    8""88888P'      o888o     o8o        o888o o888bood8P'   `Y8bood8P'  o888ooooood8 8""88888P'  
+ *                                                                                                  
+ *                                                                                                  
+ *                                                                                                  
+ */
+
+#define P_LEN 			(path -> sel_length)
+#define P_IND 			(path -> sel_index)
+#define P_ALC 			(path -> prg_allocbits)
+#define P_LEV 			(path -> prg_level)
+#define P_PIND			(path -> prg_index)
+#define P_DATA 			(path -> prg_data)
+#define P_OWNER			(path -> owner)
+#define P_CHILD			(path -> child)
+#define P_CODE			(path -> prg_code)
+#define P_PAGES			(path -> prg_pages)
+#define P_TREE			(path -> prg_tree)
+#define P_CELL(k)		(P_DATA != NULL ? P_DATA[k] : P_TREE != NULL ? tree_read(path, k) : page_read(path, k))
+#define P_WORD(k)		read_by_bit_index(path, (k) * BITS_IN_WORD, BITS_IN_WORD)
+#define P_CELL_REF(k)	(*(P_DATA != NULL ? &P_DATA[k] : page_write(vm, path, k)))	/* Not for trees */
+#define PR_START  		(P_RUNNING -> prg_start)
+#define PR_LEV 			(P_RUNNING -> prg_level)
+#define set_level(l)	OPS = functions[PR_LEV = (l)]
+
+static void idles(Dao_vm* vm, Path path)
+{
+}
+
+static void inert(Dao_vm* vm, Path path)
+{
+	verbprint("LEV_SKIP");
+}
+
+static void swaps(Dao_vm* vm, Path path)
+{
+	unsigned int i = 0;
+	Cell report = 0;
+	verbosely printf("Swapped length %d.", P_LEN);
+	if (P_LEN == 1)	return;
+	if (P_LEN <= BITS_IN_CELL)
+	{
+		unsigned long half_len = P_LEN / 2;
+		write_by_bit_index(vm, path, P_IND, P_LEN, read_by_bit_index(path, P_IND, half_len) | (read_by_bit_index(path, P_IND + half_len, half_len) << half_len));
+		return;
+	}
+	if (P_TREE != NULL)
+	{
+		Node* node = tree_node(path, P_IND, P_LEN);
+		tree_place(vm, path, P_IND, P_LEN, node_cons(vm, node_retain(node->right), node_retain(node->left)));	/* The halves trade places */
+	}
+	else if (P_PAGES != NULL && (P_IND / BITS_IN_CELL) % PAGE_CELLS == 0 && ((P_LEN / BITS_IN_CELL) / 2) % PAGE_CELLS == 0)
+		page_swap(vm, path, (P_IND / BITS_IN_CELL) / PAGE_CELLS, ((P_LEN / BITS_IN_CELL) / 2) / PAGE_CELLS);	/* Whole pages trade places */
+	else if (P_DATA != NULL)
+		bulk_swap(P_DATA + (P_IND / BITS_IN_CELL), P_DATA + (P_IND / BITS_IN_CELL) + ((P_LEN / BITS_IN_CELL) / 2), (P_LEN / BITS_IN_CELL) / 2);
+	else while (i < ((P_LEN / BITS_IN_CELL) / 2))
+	{
+		report = P_CELL((P_IND / BITS_IN_CELL) + i);
+		P_CELL_REF((P_IND / BITS_IN_CELL) + i) = P_CELL((P_IND / BITS_IN_CELL) + ((P_LEN / BITS_IN_CELL) / 2) + i);
+		P_CELL_REF((P_IND / BITS_IN_CELL) + ((P_LEN / BITS_IN_CELL) / 2) + i++) = report;
+	}
+	recode(path, P_IND, P_LEN);
+}
+
+static void later(Dao_vm* vm, Path path)
+{
+	if (algn(path))	P_IND += P_LEN;
+	else			merge(vm, path);
+}
+
+static void lines(Dao_vm* vm, Path path)
+{
+	P_IND += P_LEN;
+}
+
+static void merge(Dao_vm* vm, Path path)
+{
+	if (P_LEN < P_ALC)
+	{
+		if (!algn(path))
+			P_IND -= P_LEN;
+		P_LEN <<= 1;
+		return;
+	}
+	if (P_OWNER == NULL)
+		return;
+	vm -> memo_pure = 0;
+	P_WRITTEN = P_OWNER;
+	(P_WRITTEN->sel_length) = 1;
+	(P_WRITTEN->sel_index) = 1;
+}
+
+static void sifts(Dao_vm* vm, Path path)
+{
+	unsigned long r, w = P_IND;
+	Cell nybble;
+	if (P_IND + 4 >= P_ALC)
+		return;
+	if (P_DATA != NULL && P_IND % 4 == 0 && P_ALC % BITS_IN_CELL == 0)
+	{
+		sift_cells(P_DATA + P_IND / BITS_IN_CELL, (P_ALC - P_IND + BITS_IN_CELL - 1) / BITS_IN_CELL, (P_IND % BITS_IN_CELL) / 4);
+		recode(path, P_IND, P_ALC - P_IND);
+		return;
+	}
+	for (r = P_IND; ; r += 4)														/* Nonzero nybbles keep their order, zeros go last */
+	{
+		if ((nybble = read_by_bit_index(path, r, 4)) != 0)
+		{
+			if (r != w)
+			{
+				write_by_bit_index(vm, path, w, 4, nybble);
+				write_by_bit_index(vm, path, r, 4, 0);
+			}
+			w += 4;
+		}
+		if (r + 4 >= P_ALC)
+			break;
+	}
+}
+
+/*
+* With -m, an EXECS remembers its result. The key is everything the run can see: the
+* program with its start and level, and the written child's tape and selection. While
+* the run stays on the child and does no I/O it is pure, and when it leaves, the child's
+* tape and selection and the program's level are stored against the key. The next EXECS
+* with the same key puts them back instead of running. Each key hashes to one of
+* MEMO_SLOTS slots, and a newer result takes the slot from an older one.
+*/
+static unsigned long memo_cells(Path path, Cell* dest)
+{
+	unsigned long k = 0;
+	unsigned long cells = tape_bytes(P_ALC) / sizeof(Cell);
+	if (dest != NULL)
+		for (; k < cells; k++)
+			dest[k] = P_CELL(k);
+	return cells;
+}
+
+static unsigned long memo_hash(Cell* cells, unsigned long count)
+{
+	unsigned long hash = 0x811C9DC5UL;
+	for (; count-- > 0; cells++)
+		hash = (hash ^ (unsigned long)(*cells ^ (*cells >> (BITS_IN_CELL / 2)))) * 0x01000193UL;
+	return hash;
+}
+
+/* Takes the key for running path on its child. */
+static int memo_key(Dao_vm* vm, Path path)
+{
+	Path data = P_CHILD;
+	unsigned long cells = MEMO_KEY + memo_cells(path, NULL) + memo_cells(data, NULL);
+	Cell* key;
+	if (cells > MEMO_MAX_CELLS || (key = tape_new(vm, cells * BITS_IN_CELL)) == NULL)
+		return 0;
+	key[0] = P_ALC;
+	key[1] = P_IND / 4;
+	key[2] = P_LEV;
+	key[3] = data->prg_allocbits;
+	key[4] = data->sel_length;
+	key[5] = data->sel_index;
+	memo_cells(data, key + MEMO_KEY + memo_cells(path, key + MEMO_KEY));
+	vm -> memo_open.key = key;
+	vm -> memo_open.key_cells = cells;
+	vm -> memo_open.hash = memo_hash(key, cells);
+	return 1;
+}
+
+static int memo_recall(Dao_vm* vm, Path path)
+{
+	Memo* slot = &vm -> memos[vm -> memo_open.hash & (MEMO_SLOTS - 1)];
+	Path data = P_CHILD;
+	Cell* result = slot->result;
+	if (slot->key == NULL || slot->hash != vm -> memo_open.hash || slot->key_cells != vm -> memo_open.key_cells
+		|| memcmp(slot->key, vm -> memo_open.key, vm -> memo_open.key_cells * sizeof(Cell)) != 0)
+	{
+		vm -> memo_misses++;
+		return 0;
+	}
+	tape_free(vm, vm -> memo_open.key, vm -> memo_open.key_cells * BITS_IN_CELL);
+	vm -> memo_open.key = NULL;
+	vm -> memo_hits++;
+	uncode(vm, data);
+	tape_release(vm, data);
+	if (tape_alloc(vm, data, result[0]) == NULL)
+		tape_fail(vm, tape_bytes(result[0]));
+	memcpy(data->prg_data, result + MEMO_RESULT, (slot->result_cells - MEMO_RESULT) * sizeof(Cell));
+	data->prg_allocbits = result[0];
+	data->sel_length = result[1];
+	data->sel_index = result[2];
+	P_LEV = result[3];
+	P_PIND = result[4];
+	path->prg_start = P_IND / 4;
+	return 1;
+}
+
+/* Called as the recorded run leaves, while its child is still there. */
+static void memo_store(Dao_vm* vm, Path path)
+{
+	Path data = P_CHILD;
+	Memo* slot = &vm -> memos[vm -> memo_open.hash & (MEMO_SLOTS - 1)];
+	unsigned long cells = (data == NULL) ? 0 : MEMO_RESULT + memo_cells(data, NULL);
+	Cell* result = NULL;
+	if (!vm -> memo_pure || data == NULL || cells > MEMO_MAX_CELLS || (result = tape_new(vm, cells * BITS_IN_CELL)) == NULL)
+	{
+		tape_free(vm, vm -> memo_open.key, vm -> memo_open.key_cells * BITS_IN_CELL);
+		vm -> memo_open.key = NULL;
+		return;
+	}
+	result[0] = data->prg_allocbits;
+	result[1] = data->sel_length;
+	result[2] = data->sel_index;
+	result[3] = P_LEV;
+	result[4] = P_PIND;
+	memo_cells(data, result + MEMO_RESULT);
+	memo_drop(vm, slot);
+	*slot = vm -> memo_open;
+	slot->result = result;
+	slot->result_cells = cells;
+	vm -> memo_open.key = NULL;
+}
+
+static void memo_drop(Dao_vm* vm, Memo* slot)
+{
+	tape_free(vm, slot->key, slot->key_cells * BITS_IN_CELL);
+	tape_free(vm, slot->result, slot->result_cells * BITS_IN_CELL);
+	memset(slot, 0, sizeof(Memo));
+}
+
+static void execs(Dao_vm* vm, Path path)
+{
+	/****************************************************************ENTER PROGRAM***************************************************************/
+	if (vm -> frame_count == vm -> frame_alloc)												/* Grow the frame stack 							*/
+	{
+		Frame* grown = realloc(vm -> frames, (vm -> frame_alloc ? vm -> frame_alloc * 2 : 64) * sizeof(Frame));
+		if (grown == NULL)
+		{
+			printf("FATAL ERROR: Unable to allocate memory.");
+			return;
+		}
+		vm -> frames = grown;
+		vm -> frame_alloc = vm -> frame_alloc ? vm -> frame_alloc * 2 : 64;
+	}
+
+	if (P_CHILD == NULL)																	/* If there is no child 							*/
+	{
+		if ((P_CHILD = path_new(vm, path)) == NULL)											/* Allocate memory space 							*/
+		{																					/* Cover error case							 		*/
+			printf("FATAL ERROR: Unable to allocate memory.");
+			return;
+		}
+		verbosely printf("Allocated %d bytes.\n\n", sizeof(*P_CHILD));
+	}
+	else
+		verbosely putchar('\n');
+
+	if (vm -> memo_frame != 0)																/* Not remembered as part of the EXECS around it 	*/
+		vm -> memo_pure = 0;
+	else if (MEMO && P_RUNNING != NULL && memo_key(vm, path))
+	{
+		if (memo_recall(vm, path))															/* Same program on the same data: skip to the end 	*/
+		{
+			verbosely printf("Recalled the result of this program.");
+			return;
+		}
+		vm -> memo_pure = 1;																/* Record this run until it leaves 					*/
+		vm -> memo_frame = vm -> frame_count + 1;
+	}
+
+	vm -> frames[vm -> frame_count].path = path;											/* Push the frame 									*/
+	vm -> frames[vm -> frame_count++].caller = P_RUNNING;									/* Path to return to, NULL at the top level			*/
+	P_RUNNING = path;																		/* Set running 										*/
+	OPS = functions[PR_LEV];																/* Dispatch for its level							*/
+	P_WRITTEN = P_CHILD;																	/* Set this as written on 							*/
+	P_PIND = (P_IND / 4);																	/* Set program pointer. Rounds down.x				*/
+	PR_START = P_PIND;																		/* Track start position 							*/
+}
+
+static void leave(Dao_vm* vm)
+{
+	/****************************************************************LEAVE PROGRAM***************************************************************/
+	Path path = vm -> frames[--vm -> frame_count].path;										/* Pop the frame 									*/
+	Path caller = vm -> frames[vm -> frame_count].caller;
+	if (vm -> memo_frame > vm -> frame_count)												/* The recorded run is over 						*/
+	{
+		memo_store(vm, path);
+		vm -> memo_frame = 0;
+	}
+	if (caller == NULL)
+	{
+		verbprint("Top-level program terminated.\n")
+		path_free(vm, P_CHILD);
+		P_CHILD = NULL;
+		return;
+	}
+	if (!vm -> doloop)
+	{
+		verbosely printf("Freed %d bytes.\n\n", sizeof(*P_CHILD));
+		path_free(vm, P_CHILD);
+		P_CHILD = NULL;
+		vm -> doloop = 1;
+	}
+	P_RUNNING = caller;
+	P_WRITTEN = caller->child;
+	OPS = functions[PR_LEV];
+}
+
+/*
+* Runs the frame stack until it is back down to base frames.
+* EXECS only pushes a frame and LEAVE pops one, so nesting costs a Frame, not a C stack frame.
+*/
+static void run(Dao_vm* vm, unsigned long base)
+{
+	/***************************************************************EXECUTION LOOP***************************************************************/
+	unsigned long tempNum1 = 0;																/* Expedite calculation								*/
+	unsigned long depth = 0;																/* Frame count before the command 					*/
+	Path path = P_RUNNING;																	/* Running program 									*/
+
+	if (vm -> frame_count <= base)															/* Nothing was entered 								*/
+		return;
+#if defined(__GNUC__)
+	if (THREADED && !vm -> budgeted)
+	{
+		run_decoded(vm, base);																/* Pre-decoded, threaded execution loop 			*/
+		return;
+	}
+#endif
+
+	while (vm -> frame_count > base)														/* Execution Loop 									*/
+	{
+		if (!vm -> doloop || P_PIND >= (P_ALC / 4) || P_WRITTEN == NULL)					/* Program over: return to caller 					*/
+		{
+			leave(vm);
+			if (vm -> frame_count == base)
+				return;
+			path = P_RUNNING;
+			verbprint("\n");
+			P_PIND++;
+			continue;
+		}
+		if (vm -> budgeted && vm -> steps-- == 0)											/* Out of steps: stop before this one 				*/
+			return;
+		if (THREADED)
+		{
+			if (P_CODE == NULL)
+				decode(vm, path);
+			vm -> command = P_CODE[P_PIND];
+		}
+		else
+		{
+			tempNum1 = (P_RUNNING->prg_index);
+			vm -> command = read_by_bit_index(P_RUNNING, tempNum1 * 4, 4);					/* Calculate command		*/
+		}
+		if (OPS[vm -> command] == input && !in_wait(vm, P_WRITTEN))							/* No input yet: stop before this one 				*/
+		{
+			if (vm -> budgeted)
+				vm -> steps++;
+			return;
+		}
+		verbosely diagnose(vm, path, vm -> command);
+
+		depth = vm -> frame_count;
+		OPS[vm -> command](vm, P_WRITTEN);
+		if (vm -> frame_count != depth)														/* EXECS: start the new program in place 			*/
+		{
+			path = P_RUNNING;
+			continue;
+		}
+		verbprint("\n");
+		P_PIND++;
+	}
+}
+
+#if defined(__GNUC__)
+/*
+* Threaded counterpart of the execution loop in run().
+* The running program is decoded once into one opcode per byte (see decode()), so a step is
+* an array load and an indirect jump instead of a divide, shift and mask followed by a call.
+* Writes into a decoded path patch the array as they happen, so self-modification is seen.
+* The jump tables mirror functions[][], so only DELEV, UPLEV and frame changes switch them.
+* They are filled by a call with no VM, made once from dao_setup().
+*/
+static void run_decoded(Dao_vm* vm, unsigned long base)
+{
+	static const PathFunc handlers[19] = \
+		{idles, swaps, later, merge, sifts, execs, delev, equal, halve, uplev, \
+		reads, dealc, split, polar, doalc, input, inert, lines, NULL};
+	static void* targets[19] = \
+		{&&op_idles, &&op_swaps, &&op_later, &&op_merge, &&op_sifts, &&op_execs, &&op_delev, &&op_equal, &&op_halve, &&op_uplev, \
+		&&op_reads, &&op_dealc, &&op_split, &&op_polar, &&op_doalc, &&op_input, &&op_inert, &&op_lines, NULL};
+	static void* dispatch[10][16] = { { NULL } };
+	void** labels = NULL;
+	Path path = NULL;
+
+	if (vm == NULL)
+	{
+		int l, c, h;
+		for (l = 0; l < 10; l++)
+			for (c = 0; c < 16; c++)
+				for (h = 0; handlers[h] != NULL; h++)
+					if (functions[l][c] == handlers[h])
+						dispatch[l][c] = targets[h];
+		return;
+	}
+	path = P_RUNNING;
+	labels = dispatch[PR_LEV];
+
+#define DISPATCH()	if (!vm -> doloop || P_PIND >= (P_ALC / 4) || P_WRITTEN == NULL) goto op_leave;	\
+					if (P_CODE == NULL) decode(vm, path);											\
+					vm -> command = P_CODE[P_PIND];													\
+					verbosely diagnose(vm, path, vm -> command);											\
+					goto *labels[vm -> command]
+#define NEXT()		verbprint("\n"); P_PIND++; DISPATCH()
+
+	DISPATCH();
+	op_idles:	NEXT();
+	op_inert:	inert(vm, P_WRITTEN); NEXT();
+	op_swaps:	swaps(vm, P_WRITTEN); NEXT();
+	op_later:	later(vm, P_WRITTEN); NEXT();
+	op_lines:	lines(vm, P_WRITTEN); NEXT();
+	op_merge:	merge(vm, P_WRITTEN); NEXT();
+	op_sifts:	sifts(vm, P_WRITTEN); NEXT();
+	op_delev:	delev(vm, P_WRITTEN); labels = dispatch[PR_LEV]; NEXT();
+	op_equal:	equal(vm, P_WRITTEN); NEXT();
+	op_halve:	halve(vm, P_WRITTEN); NEXT();
+	op_uplev:	uplev(vm, P_WRITTEN); labels = dispatch[PR_LEV]; NEXT();
+	op_reads:	reads(vm, P_WRITTEN); NEXT();
+	op_dealc:	dealc(vm, P_WRITTEN); NEXT();
+	op_split:	split(vm, P_WRITTEN); NEXT();
+	op_polar:	polar(vm, P_WRITTEN); NEXT();
+	op_doalc:	doalc(vm, P_WRITTEN); NEXT();
+	op_input:	if (!in_wait(vm, P_WRITTEN))
+					return;
+				input(vm, P_WRITTEN); NEXT();
+	op_execs:
+		{
+			unsigned long depth = vm -> frame_count;
+			execs(vm, P_WRITTEN);
+			if (vm -> frame_count == depth)
+			{
+				NEXT();
+			}
+		}
+		path = P_RUNNING;
+		labels = dispatch[PR_LEV];
+		DISPATCH();
+	op_leave:
+		leave(vm);
+		if (vm -> frame_count == base)
+			return;
+		path = P_RUNNING;
+		labels = dispatch[PR_LEV];
+		NEXT();
+
+#undef NEXT
+#undef DISPATCH
+}
+#endif
+
+static void delev(Dao_vm* vm, Path path)
+{
+	(void)path;
+	if (PR_LEV > 0) set_level(PR_LEV - 1);
+}
+
+static void equal(Dao_vm* vm, Path path)
+{
+	if (read_by_bit_index(path, P_IND, 1) ^ read_by_bit_index(path, P_IND + P_LEN - 1, 1))
+		skip(vm);
+	else
+		verbprint("EQUAL");
+}
+
+static void halve(Dao_vm* vm, Path path)
+{
+	if (P_LEN > 1)
+	{
+		P_LEN /= 2;
+		return;
+	}
+	if (P_CHILD == NULL)
+		return;
+	vm -> memo_pure = 0;
+	P_WRITTEN = P_CHILD;
+	(P_WRITTEN->sel_length) = (P_WRITTEN->prg_allocbits);
+}
+
+static void uplev(Dao_vm* vm, Path path)
+{
+	(void)path;
+	set_level(PR_LEV + 1);
+	(P_RUNNING->prg_index) = PR_START - 1;
+}
+
+static void reads(Dao_vm* vm, Path path)
+{
+	unsigned long pos = P_IND;
+	Cell cell;
+	char byte;
+	vm -> memo_pure = 0;
+	if (P_LEN < 8)
+		for (; pos < (P_IND + P_LEN); pos++)
+		{
+			byte = '0' + (char)read_by_bit_index(path, pos, 1);
+			out_write(vm, &byte, 1);
+		}
+	else if (pos % BITS_IN_CELL == 0 && P_LEN >= BITS_IN_CELL && P_IND + P_LEN <= P_ALC)
+		for (; pos < (P_IND + P_LEN); pos += BITS_IN_CELL)
+		{
+			cell = P_CELL(pos / BITS_IN_CELL);									/* Already in file order			*/
+			out_write(vm, (char*)&cell, sizeof(Cell));
+		}
+	else
+		for (; pos < (P_IND + P_LEN); pos += 8)
+		{
+			byte = (char)read_by_bit_index(path, pos, 8);
+			out_write(vm, &byte, 1);
+		}
+	if (FLUSH_READS || VERBOSE || vm -> out_newline)
+		out_flush(vm);
+}
+
+static void dealc(Dao_vm* vm, Path path)
+{
+	if (P_ALC == 1)
+	{
+		int report = read_by_bit_index(path, 0, 1);
+		vm -> memo_pure = 0;
+		if ((P_RUNNING->owner) != NULL)
+		{
+			unsigned long ownind = ((P_RUNNING->owner)->prg_index);
+			verbosely printf("Terminating program from position %x with value %x", ownind, report);
+			write_by_bit_index(vm, P_RUNNING->owner, (ownind) * 4, 4, report);
+		}
+		uncode(vm, path);
+		tape_release(vm, path);
+		vm -> doloop = 0;
+		return;
+	}
+	uncode(vm, path);
+	tape_shrink(vm, path);
+	if (P_LEN > 1)
+		halve(vm, path);
+	if ((P_IND + P_LEN) > P_ALC)
+		P_IND -= P_ALC;
+}
+
+static void split(Dao_vm* vm, Path path)
+{
+	unsigned int len = P_LEN;
+	if (len == 1)
+	{
+		if (P_CHILD == NULL)
+			return;
+		vm -> memo_pure = 0;
+		P_WRITTEN = P_CHILD;
+		(P_WRITTEN->sel_length) = (P_WRITTEN->prg_allocbits);
+		split(vm, P_WRITTEN);
+		halve(vm, P_WRITTEN);
+		return;
+	}
+	if (len <= BITS_IN_CELL)
+	{
+		write_by_bit_index(vm, path, P_IND, len >> 1, mask(len));
+		write_by_bit_index(vm, path, P_IND + (len >> 1), len >> 1, ~mask(len));
+	}
+	else if (P_IND >= P_ALC || len > P_ALC - P_IND)						/* Off the end: only what is on the tape is set	*/
+	{
+		unsigned long k = 0;
+		for (; k < len; k += BITS_IN_CELL)
+			write_by_bit_index(vm, path, P_IND + k, BITS_IN_CELL, (k < len / 2) ? CELL_ONES : 0);
+	}
+	else
+	{
+		unsigned int leftIndex = (P_IND / BITS_IN_CELL);
+		unsigned int rightIndex = leftIndex + (len / BITS_IN_CELL) - 1;
+		if (P_TREE != NULL)
+			tree_place(vm, path, P_IND, len, node_cons(vm, tree_uniform(vm, CELL_ONES, tape_class(len) - 1), tree_uniform(vm, 0, tape_class(len) - 1)));
+		else if (P_PAGES != NULL && leftIndex % PAGE_CELLS == 0 && (len / BITS_IN_CELL / 2) % PAGE_CELLS == 0)
+		{
+			for (; rightIndex >= leftIndex + (len / BITS_IN_CELL / 2); rightIndex -= PAGE_CELLS)
+				page_drop(vm, path, rightIndex / PAGE_CELLS);					/* The right half goes back to the zero page		*/
+			while (leftIndex <= rightIndex)
+				P_CELL_REF(leftIndex++) = CELL_ONES;
+		}
+		else if (P_DATA != NULL)
+		{
+			memset(P_DATA + leftIndex, BYTE_MASK, (len / BITS_IN_CELL / 2) * sizeof(Cell));	/* libc picks its own vector fill */
+			memset(P_DATA + leftIndex + (len / BITS_IN_CELL / 2), 0, (len / BITS_IN_CELL / 2) * sizeof(Cell));
+		}
+		else while (leftIndex < rightIndex)
+		{
+			P_CELL_REF(leftIndex++) = CELL_ONES;
+			P_CELL_REF(rightIndex--) = 0;
+		}
+		recode(path, P_IND, len);
+	}
+	halve(vm, path);
+}
+
+static void polar(Dao_vm* vm, Path path)
+{
+	if (!(read_by_bit_index(path, P_IND, 1) && !read_by_bit_index(path, P_IND + P_LEN - 1, 1)))
+		skip(vm);
+	else
+		verbprint("POLAR");
+}
+
+static void doalc(Dao_vm* vm, Path path)
+{
+	if (!tape_grow(vm, path))
+	{
+		vm -> memo_pure = 0;
+		out_flush(vm);
+		printf("Error allocating %lu bytes: ", (P_ALC << 1) / BITS_IN_BYTE);
+		perror("");
+		if (SKIP_OVERFLOW)
+			return;
+		abort();
+	}
+	merge(vm, path);
+}
+
+static void input(Dao_vm* vm, Path path)
+{
+	unsigned long i = P_IND;
+	unsigned int b;
+	Cell cell;
+	vm -> memo_pure = 0;
+	out_flush(vm);															/* Whatever asked for the input is seen first */
+	if (P_LEN < 8)
+		write_by_bit_index(vm, path, P_IND, P_LEN, in_get(vm));
+	else if (i % BITS_IN_CELL == 0 && P_LEN >= BITS_IN_CELL && P_DATA != NULL && i + P_LEN <= P_ALC)
+	{
+		in_fill(vm, (unsigned char*)(P_DATA + i / BITS_IN_CELL), P_LEN / BITS_IN_BYTE);
+		recode(path, P_IND, P_LEN);
+	}
+	else if (i % BITS_IN_CELL == 0 && P_LEN >= BITS_IN_CELL)
+		for (; i < (P_IND + P_LEN); i += BITS_IN_CELL)
+		{
+			for (cell = 0, b = 0; b < sizeof(Cell); b++)
+				cell = (cell << BITS_IN_BYTE) | (in_get(vm) & BYTE_MASK);
+			write_by_bit_index(vm, path, i, BITS_IN_CELL, cell);
+		}
+	else for (; i < (P_IND + P_LEN); i += 8)
+		write_by_bit_index(vm, path, i, 8, in_get(vm));
+}
+
+/***
+ *    oooooooooooo ooooooooooooo   .oooooo.   
+ *    `888'     `8 8'   888   `8  d8P'  `Y8b  
+ *     888              888      888          
+ *     888oooo8         888      888          
+ *     888    "         888      888          
+ *     888       o      888      `88b    ooo  
+ *    o888ooooood8     o888o      `Y8bood8P'  
+ *                                            
+ *                                            
+ *                                            
+ */
+
+/*
+* Bulk kernels for selections of whole cells on flat tapes. bulk_setup() asks the CPU what
+* it has and points bulk_swap at the widest kernel it can run. Tapes
+* are carved on cache lines, but halves of a selection need not be, so loads and stores
+* are unaligned ones.
+*/
+static void bulk_swap_cells(Cell* a, Cell* b, size_t cells)
+{
+	size_t i;
+	Cell c;
+	for (i = 0; i < cells; i++)
+	{
+		c = a[i];
+		a[i] = b[i];
+		b[i] = c;
+	}
+}
+
+#if defined(BULK_X86)
+__attribute__((target("sse2")))
+static void bulk_swap_sse2(Cell* a, Cell* b, size_t cells)
+{
+	char* x = (char*)a;
+	char* y = (char*)b;
+	size_t n = cells * sizeof(Cell), i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i u = _mm_loadu_si128((__m128i*)(x + i));
+		__m128i v = _mm_loadu_si128((__m128i*)(y + i));
+		_mm_storeu_si128((__m128i*)(x + i), v);
+		_mm_storeu_si128((__m128i*)(y + i), u);
+	}
+	bulk_swap_cells((Cell*)(x + i), (Cell*)(y + i), (n - i) / sizeof(Cell));
+}
+
+__attribute__((target("avx2")))
+static void bulk_swap_avx2(Cell* a, Cell* b, size_t cells)
+{
+	char* x = (char*)a;
+	char* y = (char*)b;
+	size_t n = cells * sizeof(Cell), i = 0;
+	for (; i + 64 <= n; i += 64)												/* A cache line from each side per step */
+	{
+		__m256i u0 = _mm256_loadu_si256((__m256i*)(x + i));
+		__m256i u1 = _mm256_loadu_si256((__m256i*)(x + i + 32));
+		__m256i v0 = _mm256_loadu_si256((__m256i*)(y + i));
+		__m256i v1 = _mm256_loadu_si256((__m256i*)(y + i + 32));
+		_mm256_storeu_si256((__m256i*)(x + i), v0);
+		_mm256_storeu_si256((__m256i*)(x + i + 32), v1);
+		_mm256_storeu_si256((__m256i*)(y + i), u0);
+		_mm256_storeu_si256((__m256i*)(y + i + 32), u1);
+	}
+	bulk_swap_sse2((Cell*)(x + i), (Cell*)(y + i), (n - i) / sizeof(Cell));
+}
+#endif
+
+
+/*
+* SIFTS on a flat tape packs cell by cell. Each cell's nonzero nybbles, and the nybbles
+* of the first cell ahead of the selection, are gathered into the low end of a word,
+* with PEXT where the CPU has it, and appended to an accumulator that is written back
+* behind the read position a whole cell at a time. What is left is zeroed.
+*/
+static Cell sift_pack_plain(Cell c, Cell keep, unsigned int* count)
+{
+	Cell packed = 0;
+	unsigned int shift = BITS_IN_CELL;
+	*count = 0;
+	while (shift)
+	{
+		shift -= 4;
+		if ((keep >> shift) & 0xF)
+		{
+			packed = (packed << 4) | ((c >> shift) & 0xF);
+			(*count)++;
+		}
+	}
+	return packed;
+}
+
+#if defined(BULK_X86) && (CELL_BITS == 32 || (CELL_BITS == 64 && defined(__x86_64__)))
+#define SIFT_PEXT
+__attribute__((target("bmi2,popcnt")))
+static inline Cell sift_pack_pext(Cell c, Cell keep, unsigned int* count)
+{
+#if CELL_BITS == 64
+	*count = __builtin_popcountll(keep) / 4;
+	return _pext_u64(c, keep);
+#else
+	*count = __builtin_popcount(keep) / 4;
+	return _pext_u32(c, keep);
+#endif
+}
+#endif
+
+static inline void sift_run(Cell* cells, unsigned long count, unsigned int ahead, Cell (*pack)(Cell, Cell, unsigned int*))
+{
+	Cell acc = 0, keep, packed, c;
+	unsigned long r, w = 0;
+	unsigned int have = 0, got, spill;
+	for (r = 0; r < count; r++)
+	{
+		c = cell_value(cells[r]);
+		keep = ((c | c >> 1 | c >> 2 | c >> 3) & NYBBLE_LOWS) * 0xF;
+		if (r == 0 && ahead)
+			keep |= ~(CELL_ONES >> (4 * ahead));								/* Nybbles ahead of the selection stay */
+		if (keep == 0)
+			continue;
+		packed = pack(c, keep, &got);
+		if (have + got < BITS_IN_CELL / 4)
+		{
+			acc |= packed << (BITS_IN_CELL - 4 * (have + got));
+			have += got;
+			continue;
+		}
+		spill = have + got - BITS_IN_CELL / 4;
+		cells[w++] = cell_value(acc | (spill ? packed >> (4 * spill) : packed));	/* Never ahead of r */
+		acc = spill ? packed << (BITS_IN_CELL - 4 * spill) : 0;
+		have = spill;
+	}
+	if (have)
+		cells[w++] = cell_value(acc);
+	memset(cells + w, 0, (count - w) * sizeof(Cell));
+}
+
+static void sift_cells_plain(Cell* cells, unsigned long count, unsigned int ahead)
+{
+	sift_run(cells, count, ahead, sift_pack_plain);
+}
+
+#if defined(SIFT_PEXT)
+__attribute__((target("bmi2,popcnt")))
+static void sift_cells_pext(Cell* cells, unsigned long count, unsigned int ahead)
+{
+	sift_run(cells, count, ahead, sift_pack_pext);
+}
+#endif
+
+/* Points bulk_swap and sift_cells at the widest kernels this CPU runs; once, from dao_setup(). */
+static void bulk_setup(void)
+{
+#if defined(BULK_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		bulk_swap = bulk_swap_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		bulk_swap = bulk_swap_sse2;
+#endif
+#if defined(SIFT_PEXT)
+	if (__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt"))
+		sift_cells = sift_cells_pext;
+#endif
+}
+
+/*
+* READS output is gathered in out_buf and written out when it fills, when a line ends and
+* lines are wanted, after every READS with -r or -v, before INPUT waits on the user, and
+* when the program is over, so stdout is locked once per flush instead of once per byte.
+*/
+static void out_write(Dao_vm* vm, const char* bytes, size_t count)
+{
+	size_t part;
+	if (vm -> out_lines && memchr(bytes, '\n', count) != NULL)
+		vm -> out_newline = 1;
+	while (count > 0)
+	{
+		if (vm -> out_used == OUT_BYTES)
+			out_flush(vm);
+		part = (count < OUT_BYTES - vm -> out_used) ? count : OUT_BYTES - vm -> out_used;
+		memcpy(vm -> out_buf + vm -> out_used, bytes, part);
+		vm -> out_used += part;
+		bytes += part;
+		count -= part;
+	}
+}
+
+static void out_flush(Dao_vm* vm)
+{
+	if (vm -> write != NULL)
+	{
+		if (vm -> out_used > 0)
+			vm -> write(vm -> user, vm -> out_buf, vm -> out_used);
+	}
+	else
+	{
+		if (vm -> out_used > 0)
+			fwrite(vm -> out_buf, 1, vm -> out_used, stdout);
+		fflush(stdout);
+	}
+	vm -> out_used = 0;
+	vm -> out_newline = 0;
+}
+
+/*
+* When stdin is not a terminal INPUT takes it in blocks. A regular file is mapped whole,
+* and anything else is read IN_BYTES at a time. in_get() returns bytes or EOF exactly as
+* getchar() would, and in_fill() copies a run of bytes, padding with EOF's 0xFF. Terminals
+* and the prompt stay with getchar().
+*/
+static int in_refill(Dao_vm* vm)
+{
+#if !defined(_WIN32)
+	ssize_t got;
+#endif
+	if (vm -> read != NULL)													/* The embedder's input, not stdin		*/
+	{
+		size_t given = vm -> read(vm -> user, vm -> in_block, IN_BYTES);
+		if (given == DAO_AGAIN)												/* in_wait() has every byte of the INPUT, so this is past an end it saw */
+			given = 0;
+		vm -> in_next = vm -> in_block;
+		vm -> in_end = vm -> in_block + (given < IN_BYTES ? given : IN_BYTES);
+		return given != 0;
+	}
+#if !defined(_WIN32)
+	if (!vm -> in_ready)
+	{
+		struct stat st;
+		off_t at = lseek(0, 0, SEEK_CUR);
+		void* map;
+		vm -> in_ready = 1;
+		if (fstat(0, &st) == 0 && S_ISREG(st.st_mode) && at >= 0 && st.st_size > at && (off_t)(size_t)st.st_size == st.st_size
+			&& (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 0, 0)) != MAP_FAILED)
+		{
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			lseek(0, 0, SEEK_END);											/* The map is stdin from here on			*/
+			vm -> in_next = (unsigned char*)map + at;
+			vm -> in_end = (unsigned char*)map + st.st_size;
+			vm -> in_map = map;
+			vm -> in_map_size = st.st_size;
+			vm -> in_ready = 2;
+			return 1;
+		}
+	}
+	if (vm -> in_ready == 2)												/* Mapped input runs out at its end		*/
+		return 0;
+	do
+		got = read(0, vm -> in_block, IN_BYTES);
+	while (got < 0 && errno == EINTR);
+	if (got <= 0)
+		return 0;
+	vm -> in_next = vm -> in_block;
+	vm -> in_end = vm -> in_block + got;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Lets go of a mapped stdin, once nothing points into it. */
+static void in_unmap(Dao_vm* vm)
+{
+#if !defined(_WIN32)
+	if (vm -> in_map != NULL)
+		munmap(vm -> in_map, vm -> in_map_size);
+#endif
+	vm -> in_map = NULL;
+	vm -> in_map_size = 0;
+}
+
+/*
+* An embedder's read can answer DAO_AGAIN for input that is not there yet. Before each INPUT,
+* in_wait() gathers the bytes it takes at the front of in_block, and if they have not all come
+* it leaves the VM waiting, so the INPUT runs again from the start when dao_run() is called
+* next. An INPUT wider than IN_BYTES is gathered in in_wide, so no part of it is ever taken
+* before the rest has come.
+*/
+static int in_wait(Dao_vm* vm, Path path)
+{
+	size_t want = (P_LEN < 8) ? 1 : P_LEN / 8, room = (want > IN_BYTES) ? want : IN_BYTES, have, given;
+	if (vm -> read == NULL)
+		return 1;
+	have = vm -> in_end - vm -> in_next;
+	if (have >= want)
+		return 1;
+	if (in_room(vm, want) == NULL)
+		tape_fail(vm, want);
+	while (have < want)
+	{
+		given = vm -> read(vm -> user, vm -> in_end, room - have);
+		if (given == DAO_AGAIN)
+		{
+			vm -> waiting = 1;
+			return 0;
+		}
+		if (given == 0)														/* The end: INPUT pads with EOF as ever	*/
+			return 1;
+		if (given > room - have)
+			given = room - have;
+		vm -> in_end += given;
+		have += given;
+	}
+	return 1;
+}
+
+/* Moves the bytes not yet taken to the front of in_block, or of in_wide grown to want bytes. */
+static unsigned char* in_room(Dao_vm* vm, size_t want)
+{
+	size_t have = vm -> in_end - vm -> in_next;
+	unsigned char* room = vm -> in_block;
+	if (want > IN_BYTES && want > vm -> in_wide_alloc)
+	{
+		if ((room = malloc(want)) == NULL)
+			return NULL;
+		memcpy(room, vm -> in_next, have);
+		free(vm -> in_wide);
+		vm -> in_wide = vm -> in_next = room;
+		vm -> in_wide_alloc = want;
+	}
+	else if (want > IN_BYTES)
+		room = vm -> in_wide;
+	memmove(room, vm -> in_next, have);
+	vm -> in_next = room;
+	vm -> in_end = room + have;
+	return room;
+}
+
+static int in_get(Dao_vm* vm)
+{
+	if (!vm -> in_bulk)
+		return getchar();
+	if (vm -> in_next == vm -> in_end && !in_refill(vm))
+		return EOF;
+	return *vm -> in_next++;
+}
+
+static void in_fill(Dao_vm* vm, unsigned char* dest, size_t count)
+{
+	size_t part;
+	if (!vm -> in_bulk)
+	{
+		while (count-- > 0)
+			*dest++ = (unsigned char)getchar();
+		return;
+	}
+	while (count > 0)
+	{
+		if (vm -> in_next == vm -> in_end && !in_refill(vm))
+		{
+			memset(dest, BYTE_MASK, count);
+			return;
+		}
+		part = ((size_t)(vm -> in_end - vm -> in_next) < count) ? (size_t)(vm -> in_end - vm -> in_next) : count;
+		memcpy(dest, vm -> in_next, part);
+		vm -> in_next += part;
+		dest += part;
+		count -= part;
+	}
+}
+
+static char algn(Path path)
+{
+	return P_IND % (P_LEN << 1) == 0;
+}
+
+static Cell mask(int length)
+{
+	if (length < BITS_IN_CELL)	return ((Cell)1 << length) - 1;
+	else			 	return CELL_ONES;
+}
+
+/* The len bits at i, all in one cell. */
+static Cell cell_bits(Path path, unsigned long i, unsigned long len)
+{
+	return (cell_value(P_CELL(i / BITS_IN_CELL)) >> (BITS_IN_CELL - (i % BITS_IN_CELL) - len)) & mask(len);
+}
+
+static void cell_bits_write(Dao_vm* vm, Path path, unsigned long i, unsigned long len, Cell write)
+{
+	int shift = BITS_IN_CELL - (i % BITS_IN_CELL) - len;
+	Cell* cell;
+	if (P_TREE != NULL)
+	{
+		tree_write(vm, path, i / BITS_IN_CELL, cell_value((cell_value(P_CELL(i / BITS_IN_CELL)) & ~(mask(len) << shift)) | ((write & mask(len)) << shift)));
+		return;
+	}
+	cell = &P_CELL_REF(i / BITS_IN_CELL);
+	*cell = cell_value((cell_value(*cell) & ~(mask(len) << shift)) | ((write & mask(len)) << shift));
+}
+
+/*
+* A field can straddle two cells, as an unaligned SIFTS nybble does, or run off the end of
+* the tape. Such a field is taken a cell at a time, and bits past the end read as zero and
+* are not written, so that a field means the same whatever CELL_BITS is.
+*/
+static Cell read_by_bit_index(Path path, unsigned long i, unsigned long len)
+{
+	unsigned long part;
+	Cell value = 0;
+	if ((i % BITS_IN_CELL) + len <= BITS_IN_CELL && i < P_ALC && len <= P_ALC - i)
+		return cell_bits(path, i, len);
+	for (; len > 0; i += part, len -= part)
+	{
+		if (i >= P_ALC)
+			return (len < BITS_IN_CELL) ? value << len : 0;
+		part = BITS_IN_CELL - (i % BITS_IN_CELL);
+		if (part > len)
+			part = len;
+		if (part > P_ALC - i)
+			part = P_ALC - i;
+		value = ((part < BITS_IN_CELL) ? value << part : 0) | cell_bits(path, i, part);
+	}
+	return value;
+}
+
+static void write_by_bit_index(Dao_vm* vm, Path path, unsigned long i, unsigned long len, Cell write)
+{
+	unsigned long start = i, total = len, part;
+	if (len > BITS_IN_CELL) abort();
+	if ((i % BITS_IN_CELL) + len <= BITS_IN_CELL && i < P_ALC && len <= P_ALC - i)
+		cell_bits_write(vm, path, i, len, write);
+	else for (; len > 0 && i < P_ALC; i += part, len -= part)
+	{
+		part = BITS_IN_CELL - (i % BITS_IN_CELL);
+		if (part > len)
+			part = len;
+		if (part > P_ALC - i)
+			part = P_ALC - i;
+		cell_bits_write(vm, path, i, part, write >> (len - part));
+	}
+	recode(path, start, total);
+}
+
+static void decode(Dao_vm* vm, Path path)
+{
+	unsigned long k = 0;
+	if ((P_CODE = (unsigned char*)tape_new(vm, P_ALC * 2)) == NULL)	/* A byte per nybble is twice the bits */
+	{
+		printf("Error allocating %lu bytes: ", P_ALC / 4);
+		perror("");
+		abort();
+	}
+	for (; k < P_ALC / 4; k++)
+		P_CODE[k] = read_by_bit_index(path, k * 4, 4);
+}
+
+static void recode(Path path, unsigned long i, unsigned long len)
+{
+	unsigned long k = i / 4;
+	if (P_CODE == NULL)
+		return;
+	for (; k * 4 < i + len && k < P_ALC / 4; k++)
+		P_CODE[k] = read_by_bit_index(path, k * 4, 4);
+}
+
+static void uncode(Dao_vm* vm, Path path)
+{
+	if (path == NULL || P_CODE == NULL)
+		return;
+	tape_free(vm, (Cell*)P_CODE, P_ALC * 2);
+	P_CODE = NULL;
+}
+
+/*
+* Paths, tapes and decoded programs are carved out of arena chunks and recycled through
+* free lists: paths in one list, tapes in one list per power-of-two size class.
+* Nothing is handed back to the system until pool_reset() drops every chunk at once.
+*/
+static void* pool_carve(Dao_vm* vm, size_t bytes)
+{
+	Arena* chunk = vm -> pool.arena;
+	bytes = (bytes + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+	if (chunk == NULL || chunk->used + bytes > chunk->size)
+	{
+		size_t size = (bytes > POOL_CHUNK / 4) ? bytes : POOL_CHUNK;
+		char* block = malloc(POOL_ALIGN + size + POOL_ALIGN);	/* Header, data, and slack to align the data */
+		if (block == NULL)
+			return NULL;
+		chunk = (Arena*)block;
+		chunk->size = size;
+		chunk->used = (POOL_ALIGN - (size_t)(block + POOL_ALIGN) % POOL_ALIGN) % POOL_ALIGN;
+		chunk->next = vm -> pool.arena;
+		if (size != POOL_CHUNK && vm -> pool.arena != NULL)		/* Keep carving small pieces from the current chunk */
+		{
+			chunk->next = vm -> pool.arena->next;
+			vm -> pool.arena->next = chunk;
+		}
+		else
+			vm -> pool.arena = chunk;
+	}
+	chunk->used += bytes;
+	return (char*)chunk + POOL_ALIGN + chunk->used - bytes;
+}
+
+static unsigned int tape_class(unsigned long bits)
+{
+	unsigned int k = 0;
+	unsigned long cells = (bits <= BITS_IN_CELL) ? 1 : bits / BITS_IN_CELL;
+	while ((1UL << k) < cells)
+		k++;
+	return k;
+}
+
+static Cell* tape_new(Dao_vm* vm, unsigned long bits)
+{
+	unsigned int k = tape_class(bits);
+	Cell* tape = vm -> pool.tapes[k];
+	if (tape != NULL)
+	{
+		vm -> pool.tapes[k] = *(Cell**)tape;		/* Every carved block holds at least a pointer 	*/
+		vm -> pool.tape_hits++;
+		memset(tape, 0, sizeof(Cell) << k);
+		return tape;
+	}
+	vm -> pool.tape_misses++;
+	if ((tape = pool_carve(vm, sizeof(Cell) << k)) != NULL)
+		memset(tape, 0, sizeof(Cell) << k);
+	return tape;
+}
+
+static void vm_release(char*, size_t);
+
+static void tape_free(Dao_vm* vm, Cell* tape, unsigned long bits)
+{
+	unsigned int k = tape_class(bits);
+	if (tape == NULL)
+		return;
+	*(Cell**)tape = vm -> pool.tapes[k];
+	vm -> pool.tapes[k] = tape;
+}
+
+static Path path_new(Dao_vm* vm, Path owner)
+{
+	Path path = vm -> pool.paths;
+	if (path != NULL)
+	{
+		vm -> pool.paths = P_OWNER;
+		vm -> pool.path_hits++;
+	}
+	else if ((path = pool_carve(vm, sizeof(struct PATH))) == NULL)
+		return NULL;
+	else
+		vm -> pool.path_misses++;
+	memcpy(path, &NEW_PATH, sizeof(struct PATH));				/* Copy over initialization data			 		*/
+	if (tape_alloc(vm, path, BITS_IN_CELL) == NULL)				/* Set data  of this new Path 						*/
+	{
+		P_OWNER = vm -> pool.paths;
+		vm -> pool.paths = path;
+		return NULL;
+	}
+	P_OWNER = owner;											/* Set owner of this new Path 						*/
+	path->prg_floor = owner->prg_floor + 1;						/* Set floor of this new Path 						*/
+	return path;
+}
+
+/* Frees a path with everything under it, which nothing can reach once the path is gone. */
+static void path_free(Dao_vm* vm, Path path)
+{
+	while (path != NULL)
+	{
+		Path child = P_CHILD;
+		uncode(vm, path);
+		tape_release(vm, path);
+		P_OWNER = vm -> pool.paths;
+		vm -> pool.paths = path;
+		path = child;
+	}
+}
+
+static void pool_reset(Dao_vm* vm)
+{
+	for (; vm -> pool.maps != NULL; vm -> pool.maps = vm -> pool.maps->next)
+		if (vm -> pool.maps->base != NULL)
+			vm_release(vm -> pool.maps->base, vm -> pool.maps->size);
+	while (vm -> pool.arena != NULL)
+	{
+		Arena* next = vm -> pool.arena->next;
+		free(vm -> pool.arena);
+		vm -> pool.arena = next;
+	}
+	memset(&vm -> pool, 0, sizeof(vm -> pool));
+	memset(vm -> memos, 0, sizeof(vm -> memos));							/* Remembered results were pool tapes too 			*/
+	vm -> memo_open.key = NULL;
+	vm -> memo_frame = vm -> memo_hits = vm -> memo_misses = 0;
+}
+
+/*
+* Large tapes sit at the start of their own address range, TAPE_AHEAD times the bytes they
+* first commit and at most TAPE_RESERVE, and only the first P_ALC bits are committed. DOALC
+* commits the next half in place instead of copying until the range is full, and then moves
+* the tape to a range TAPE_AHEAD times larger, so copies stay rare and many VMs' tapes fit
+* in the address space together. DEALC gives the upper half's pages back while keeping its
+* address range. Committed memory beyond P_ALC is kept zeroed, as a fresh half would be.
+*/
+static size_t vm_page()
+{
+	static size_t page = 0;
+	if (page == 0)
+	{
+#if defined(_WIN32)
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		page = info.dwPageSize;
+#else
+		page = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	}
+	return page;
+}
+
+static char* vm_reserve(size_t size)
+{
+#if defined(_WIN32)
+	return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+	char* base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return (base == MAP_FAILED) ? NULL : base;
+#endif
+}
+
+static int vm_commit(char* base, size_t from, size_t to)
+{
+#if defined(_WIN32)
+	return VirtualAlloc(base + from, to - from, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+	return mprotect(base + from, to - from, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+static void vm_decommit(char* base, size_t from, size_t to)
+{
+	if (from >= to)
+		return;
+#if defined(_WIN32)
+	VirtualFree(base + from, to - from, MEM_DECOMMIT);
+#else
+	mmap(base + from, to - from, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);	/* Loaded file pages go too */
+#endif
+}
+
+static void vm_release(char* base, size_t size)
+{
+#if defined(_WIN32)
+	(void)size;
+	VirtualFree(base, 0, MEM_RELEASE);
+#else
+	munmap(base, size);
+#endif
+}
+
+static size_t tape_bytes(unsigned long bits)
+{
+	return (bits <= BITS_IN_CELL) ? sizeof(Cell) : bits / BITS_IN_BYTE;
+}
+
+static size_t page_round(size_t bytes)
+{
+	return (bytes + vm_page() - 1) & ~(vm_page() - 1);
+}
+
+/* Address space for a tape of bytes: TAPE_AHEAD times as much, a power of two, at most TAPE_RESERVE. */
+static size_t tape_reach(size_t bytes)
+{
+	size_t reach = vm_page();
+	while (reach < TAPE_RESERVE && reach / TAPE_AHEAD < bytes)
+		reach <<= 1;
+	return reach;
+}
+
+/* Gives back the address range of a path's mapped tape. */
+static void tape_unmap(Dao_vm* vm, Path path)
+{
+	Mapping* map = vm -> pool.maps;
+	for (; map != NULL; map = map->next)
+		if (map->base == (char*)P_DATA)
+			map->base = NULL;
+	vm_release((char*)P_DATA, path->prg_reserved);
+	path->prg_mapped = path->prg_reserved = 0;
+}
+
+/* Moves a path's tape, from the pool or a range it has outgrown, into reserved address space with at least bytes committed. */
+static int tape_map(Dao_vm* vm, Path path, size_t bytes)
+{
+	Mapping* map = NULL;
+	char* base = NULL;
+	size_t reach = tape_reach(bytes);
+	if (bytes > TAPE_RESERVE || (base = vm_reserve(reach)) == NULL)
+		return 0;
+	if (!vm_commit(base, 0, page_round(bytes)) || (map = pool_carve(vm, sizeof(Mapping))) == NULL)
+	{
+		vm_release(base, reach);
+		return 0;
+	}
+	map->base = base;
+	map->size = reach;
+	map->next = vm -> pool.maps;
+	vm -> pool.maps = map;
+	if (P_DATA != NULL)
+	{
+		memcpy(base, P_DATA, tape_bytes(P_ALC));
+		if (path->prg_mapped != 0)
+			tape_unmap(vm, path);
+		else
+			tape_free(vm, P_DATA, P_ALC);
+	}
+	P_DATA = (Cell*)base;
+	path->prg_mapped = page_round(bytes);
+	path->prg_reserved = reach;
+	return 1;
+}
+
+static Cell* tape_alloc(Dao_vm* vm, Path path, unsigned long bits)
+{
+	P_DATA = NULL;
+	P_PAGES = NULL;
+	path->prg_mapped = path->prg_reserved = 0;
+	if (tape_bytes(bits) >= TAPE_MAP_MIN && tape_map(vm, path, tape_bytes(bits)))
+		return P_DATA;
+	return (P_DATA = tape_new(vm, bits));
+}
+
+/*
+* Maps a program image copy-on-write over the start of a reserved tape, so nothing is read
+* until it is touched and self-modification never reaches the file. The rest of the tape
+* past the file's last page is committed as zero pages.
+*/
+static int tape_load(Dao_vm* vm, Path path, FILE* file, size_t bytes)
+{
+#if defined(_WIN32)
+	return 0;
+#else
+	Mapping* map = NULL;
+	char* base = NULL;
+	size_t need = tape_bytes(P_ALC), reach = tape_reach(need);
+	if (need > TAPE_RESERVE || (base = vm_reserve(reach)) == NULL)
+		return 0;
+	if (mmap(base, page_round(bytes), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), 0) == MAP_FAILED
+		|| !vm_commit(base, page_round(bytes), page_round(need)) || (map = pool_carve(vm, sizeof(Mapping))) == NULL)
+	{
+		vm_release(base, reach);
+		return 0;
+	}
+	map->base = base;
+	map->size = reach;
+	map->next = vm -> pool.maps;
+	vm -> pool.maps = map;
+	P_DATA = (Cell*)base;
+	P_PAGES = NULL;
+	path->prg_mapped = page_round(need);
+	path->prg_reserved = reach;
+	return 1;
+#endif
+}
+
+static int tape_grow(Dao_vm* vm, Path path)
+{
+	size_t bytes = tape_bytes(P_ALC << 1);
+	if ((P_ALC << 1) < P_ALC)
+		return 0;
+	uncode(vm, path);
+	if (TREE && P_TREE == NULL && P_PAGES == NULL)
+		tree_convert(vm, path);
+	if (P_TREE != NULL)
+	{
+		if (P_ALC >= BITS_IN_CELL)								/* The new half is the shared node of zero cells	*/
+			P_TREE = node_cons(vm, P_TREE, tree_uniform(vm, 0, tape_class(P_ALC)));
+	}
+	else if (P_PAGES != NULL)
+	{
+		if (!sparse_resize(vm, path, P_ALC, P_ALC << 1))
+			return 0;
+	}
+	else if (SPARSE && path->prg_mapped == 0 && bytes >= TAPE_SPARSE_MIN)
+	{
+		if (!sparse_convert(vm, path, P_ALC << 1))
+			return 0;
+	}
+	else if (path->prg_mapped != 0)
+	{
+		if (page_round(bytes) > path->prg_reserved)
+		{
+			if (!tape_map(vm, path, bytes))					/* Outgrown its range: moved to a larger one		*/
+				return 0;
+		}
+		else if (bytes > path->prg_mapped)
+		{
+			if (!vm_commit((char*)P_DATA, path->prg_mapped, page_round(bytes)))
+				return 0;
+			path->prg_mapped = page_round(bytes);
+		}
+	}
+	else if (bytes < TAPE_MAP_MIN || !tape_map(vm, path, bytes))
+	{
+		Cell* grown = tape_new(vm, P_ALC << 1);
+		if (grown == NULL)
+			return 0;
+		memcpy(grown, P_DATA, tape_bytes(P_ALC));
+		tape_free(vm, P_DATA, P_ALC);
+		P_DATA = grown;
+	}
+	P_ALC <<= 1;
+	return 1;
+}
+
+static void tape_shrink(Dao_vm* vm, Path path)
+{
+	size_t old = tape_bytes(P_ALC);
+	P_ALC >>= 1;
+	if (P_ALC < BITS_IN_CELL)									/* The lost half shares a cell with the rest: as	*/
+		cell_bits_write(vm, path, P_ALC, P_ALC, 0);				/* with whole cells, it is zero if it comes back	*/
+	if (P_TREE != NULL)
+	{
+		if (P_ALC >= BITS_IN_CELL)
+		{
+			Node* kept = node_retain(P_TREE->left);
+			node_release(vm, P_TREE);
+			P_TREE = kept;
+		}
+	}
+	else if (P_PAGES != NULL)
+		sparse_shrink(vm, path);
+	else if (path->prg_mapped != 0)
+	{
+		size_t kept = tape_bytes(P_ALC);
+		if (P_ALC >= BITS_IN_CELL)
+		{
+			size_t boundary = page_round(kept) < old ? page_round(kept) : old;
+			memset((char*)P_DATA + kept, 0, boundary - kept);
+			if (boundary < path->prg_mapped)
+			{
+				vm_decommit((char*)P_DATA, boundary, path->prg_mapped);
+				path->prg_mapped = boundary;
+			}
+		}
+	}
+	else if (P_ALC >= BITS_IN_CELL)								/* The upper half is a tape of the smaller size 	*/
+		tape_free(vm, P_DATA + P_ALC / BITS_IN_CELL, P_ALC);
+}
+
+static void tape_release(Dao_vm* vm, Path path)
+{
+	if (P_TREE != NULL)
+		tree_release(vm, path);
+	if (P_PAGES != NULL)
+		sparse_release(vm, path);
+	if (P_DATA == NULL)
+		return;
+	if (path->prg_mapped != 0)
+		tape_unmap(vm, path);
+	else
+		tape_free(vm, P_DATA, P_ALC);
+	P_DATA = NULL;
+}
+
+/*
+* With -z, a pool tape that grows to TAPE_SPARSE_MIN bytes becomes a two-level page table:
+* a directory of leaves, each holding LEAF_PAGES page pointers. Pages nothing has written
+* point at one shared zero page, and leaves holding only those at one shared zero leaf,
+* so DOALC just lengthens the directory and an untouched half costs no memory at all.
+* The first write to a shared page gives it a page of its own.
+*/
+static Cell				zero_page[PAGE_CELLS];
+static Page				zero_leaf[LEAF_PAGES];
+
+#define TABLE_BITS(n)	((n) * sizeof(void*) * BITS_IN_BYTE)	/* A table of n pointers, as a tape size */
+
+/* Points every slot of the zero leaf at the zero page; run once from dao_setup(). */
+static void sparse_setup(void)
+{
+	unsigned long k = 0;
+	for (; k < LEAF_PAGES; k++)
+		zero_leaf[k] = zero_page;
+}
+
+static unsigned long sparse_pages(unsigned long bits)
+{
+	unsigned long pages = tape_bytes(bits) / PAGE_BYTES;
+	return pages ? pages : 1;
+}
+
+static unsigned long sparse_leaves(unsigned long bits)
+{
+	return (sparse_pages(bits) + LEAF_PAGES - 1) / LEAF_PAGES;
+}
+
+static void tape_fail(Dao_vm* vm, size_t bytes)
+{
+	out_flush(vm);
+	printf("Error allocating %lu bytes: ", (unsigned long)bytes);
+	perror("");
+	abort();
+}
+
+static Cell page_read(Path path, unsigned long k)
+{
+	unsigned long page = k / PAGE_CELLS;
+	return P_PAGES[page / LEAF_PAGES][page % LEAF_PAGES][k % PAGE_CELLS];
+}
+
+static Page* page_slot(Dao_vm* vm, Path path, unsigned long page)
+{
+	Leaf* leaf = &P_PAGES[page / LEAF_PAGES];
+	if (*leaf == zero_leaf)
+	{
+		Leaf own = (Leaf)tape_new(vm, TABLE_BITS(LEAF_PAGES));
+		if (own == NULL)
+			tape_fail(vm, sizeof(zero_leaf));
+		memcpy(own, zero_leaf, sizeof(zero_leaf));
+		*leaf = own;
+	}
+	return &(*leaf)[page % LEAF_PAGES];
+}
+
+static Cell* page_write(Dao_vm* vm, Path path, unsigned long k)
+{
+	Page* page = page_slot(vm, path, k / PAGE_CELLS);
+	if (*page == zero_page && (*page = tape_new(vm, PAGE_BYTES * BITS_IN_BYTE)) == NULL)
+		tape_fail(vm, PAGE_BYTES);
+	return &(*page)[k % PAGE_CELLS];
+}
+
+static void page_drop(Dao_vm* vm, Path path, unsigned long page)
+{
+	Leaf leaf = P_PAGES[page / LEAF_PAGES];
+	if (leaf != zero_leaf && leaf[page % LEAF_PAGES] != zero_page)
+	{
+		tape_free(vm, leaf[page % LEAF_PAGES], PAGE_BYTES * BITS_IN_BYTE);
+		leaf[page % LEAF_PAGES] = zero_page;
+	}
+}
+
+static void leaf_drop(Dao_vm* vm, Path path, unsigned long k)
+{
+	unsigned long j = 0;
+	if (P_PAGES[k] == zero_leaf)
+		return;
+	for (; j < LEAF_PAGES; j++)
+		if (P_PAGES[k][j] != zero_page)
+			tape_free(vm, P_PAGES[k][j], PAGE_BYTES * BITS_IN_BYTE);
+	tape_free(vm, (Cell*)P_PAGES[k], TABLE_BITS(LEAF_PAGES));
+	P_PAGES[k] = zero_leaf;
+}
+
+/* Swaps pages [page, page + count) with the count pages after them, whole leaves at a time where possible. */
+static void page_swap(Dao_vm* vm, Path path, unsigned long page, unsigned long count)
+{
+	unsigned long j = 0;
+	if (page % LEAF_PAGES == 0 && count % LEAF_PAGES == 0)
+		for (page /= LEAF_PAGES, count /= LEAF_PAGES; j < count; j++)
+		{
+			Leaf leaf = P_PAGES[page + j];
+			P_PAGES[page + j] = P_PAGES[page + count + j];
+			P_PAGES[page + count + j] = leaf;
+		}
+	else for (; j < count; j++)
+	{
+		Page* left;
+		Page* right;
+		Page swap;
+		if (P_PAGES[(page + j) / LEAF_PAGES][(page + j) % LEAF_PAGES] ==
+			P_PAGES[(page + count + j) / LEAF_PAGES][(page + count + j) % LEAF_PAGES])
+			continue;											/* Both still the zero page 						*/
+		left = page_slot(vm, path, page + j);
+		right = page_slot(vm, path, page + count + j);
+		swap = *left;
+		*left = *right;
+		*right = swap;
+	}
+}
 
-char *str_dup (char *s) {
-    char *d = malloc (strlen (s) + 1);   /*Allocate memory			*/
-    if (d != NULL) strcpy (d,s);         /*Copy string if okay		*/
-    return d;                            /*Return new memory		*/
+/* Gives path an empty sparse tape of bits, every leaf the zero leaf. */
+static int sparse_new(Dao_vm* vm, Path path, unsigned long bits)
+{
+	unsigned long k = 0;
+	Leaf* dir = (Leaf*)tape_new(vm, TABLE_BITS(sparse_leaves(bits)));
+	if (dir == NULL)
+		return 0;
+	for (; k < sparse_leaves(bits); k++)
+		dir[k] = zero_leaf;
+	P_PAGES = dir;
+	P_DATA = NULL;
+	return 1;
 }
 
-char* bin(unsigned long val) { return l_to_str(val, 32, 2, 1); }
+static int sparse_convert(Dao_vm* vm, Path path, unsigned long bits)
+{
+	unsigned long k = 0;
+	unsigned long cells = tape_bytes(P_ALC) / sizeof(Cell);
+	Cell* flat = P_DATA;
+	if (!sparse_new(vm, path, bits))
+		return 0;
+	for (k = 0; k < cells; k++)									/* Only pages with something on them are kept		*/
+		if (flat[k] != 0)
+			P_CELL_REF(k) = flat[k];
+	tape_free(vm, flat, P_ALC);
+	return 1;
+}
 
-char getChar(unsigned char ch)
+/* Moves the directory to one sized for the new length; leaves past a shorter one must already be dropped. */
+static int sparse_resize(Dao_vm* vm, Path path, unsigned long from, unsigned long to)
 {
-	if (ch > 0xF) return '?';
-	return symbols[ch];
+	unsigned long k = 0;
+	unsigned long have = sparse_leaves(from);
+	unsigned long need = sparse_leaves(to);
+	Leaf* dir;
+	if (need == have)
+		return 1;
+	if ((dir = (Leaf*)tape_new(vm, TABLE_BITS(need))) == NULL)
+		return 0;
+	for (; k < need; k++)
+		dir[k] = (k < have) ? P_PAGES[k] : zero_leaf;
+	tape_free(vm, (Cell*)P_PAGES, TABLE_BITS(have));
+	P_PAGES = dir;
+	return 1;
 }
 
-char* l_to_str(unsigned long val, unsigned char len, unsigned char radix, unsigned char override_num_only)
+static void sparse_shrink(Dao_vm* vm, Path path)
 {
-	static char buf[32] = { '0' };
-	int i = 33;
-	for (; val && i; --i, val /= radix)
-		buf[i] = ((PRINT_CODE && !override_num_only) ? ".!/)%#>=(<:S[*$;????????????????" : "0123456789ABCDEFGHIJKLMNOPQRSTUV")[val % radix];
-	for (; i; i--)
-		buf[i] = (PRINT_CODE && !override_num_only) ? '.' : '0';
-	return &buf[2 + (32 - len)];
+	unsigned long from = P_ALC << 1;
+	unsigned long page = sparse_pages(P_ALC);
+	unsigned long k = sparse_leaves(P_ALC);
+	for (; page < sparse_pages(from) && page < k * LEAF_PAGES; page++)
+		page_drop(vm, path, page);
+	for (; k < sparse_leaves(from); k++)
+		leaf_drop(vm, path, k);
+	if (!sparse_resize(vm, path, from, P_ALC))
+		tape_fail(vm, TABLE_BITS(sparse_leaves(P_ALC)) / BITS_IN_BYTE);
+	if (P_ALC >= BITS_IN_CELL && tape_bytes(P_ALC) < PAGE_BYTES && P_PAGES[0][0] != zero_page)
+		memset(P_PAGES[0][0] + P_ALC / BITS_IN_CELL, 0,			/* Keep the rest of the first page zeroed			*/
+			(tape_bytes(from) < PAGE_BYTES ? tape_bytes(from) : PAGE_BYTES) - tape_bytes(P_ALC));
 }
 
-void flip_UL(unsigned long* target)									/* Generalize this sometime, ok? */
+static void sparse_release(Dao_vm* vm, Path path)
 {
-	unsigned long num = *target;
-	*target = 0;
-	*target |= ((num >> (BITS_IN_CELL - 1 * BITS_IN_BYTE)) & (BYTE_MASK << 0 * BITS_IN_BYTE));
-	*target |= ((num >> (BITS_IN_CELL - 3 * BITS_IN_BYTE)) & (BYTE_MASK << 1 * BITS_IN_BYTE));
-	*target |= ((num << (BITS_IN_CELL - 3 * BITS_IN_BYTE)) & (BYTE_MASK << 2 * BITS_IN_BYTE));
-	*target |= ((num << (BITS_IN_CELL - 1 * BITS_IN_BYTE)) & (BYTE_MASK << 3 * BITS_IN_BYTE));
+	unsigned long k = 0;
+	for (; k < sparse_leaves(P_ALC); k++)
+		leaf_drop(vm, path, k);
+	tape_free(vm, (Cell*)P_PAGES, TABLE_BITS(sparse_leaves(P_ALC)));
+	P_PAGES = NULL;
 }
 
-/***
- *     .oooooo..o oooooo   oooo ooo        ooooo oooooooooo.    .oooooo.   ooooo         .oooooo..o 
- *    d8P'    `Y8  `888.   .8'  `88.       .888' `888'   `Y8b  d8P'  `Y8b  `888'        d8P'    `Y8 
- *    Y88bo.        `888. .8'    888b     d'888   888     888 888      888  888         Y88bo.      
- *     `"Y8888o.     `888.8'     8 Y88. .P  888   888oooo888' 888      888  888          `"Y8888o.  
- *         `"Y88b     `888'      8  `888'   888   888    `88b 888      888  888              `"Y88b 
- *    oo     .d8P      888       8    Y     888   888    .88P `88b    d88'  888       o oo     .d8P 
- *    8""88888P'      o888o     o8o        o888o o888bood8P'   `Y8bood8P'  o888ooooood8 8""88888P'  
- *                                                                                                  
- *                                                                                                  
- *                                                                                                  
- */
+/*
+* With -b, a tape that grows becomes a binary tree with one cell in each leaf, and every
+* node is hash-consed: equal subtrees are one node, shared by every tape that holds them.
+* A node never changes once made, so writing a cell rebuilds the nodes above it, while
+* SWAPS and SPLIT replace the node under the selection whole. A uniform half is just the
+* shared node for that many zero or one cells. Nodes are counted and go back to the pool
+* when nothing holds them.
+*/
+static unsigned long node_hash(Node* left, Node* right, Cell cell)
+{
+	return (unsigned long)(((size_t)left >> 4) * 31 + ((size_t)right >> 4) * 0x9E3779B1UL + (cell ^ (cell >> (BITS_IN_CELL / 2))) * 0x85EBCA6BUL);
+}
 
-#define levlim(l)		if (PR_LEV >= l) {verbprint("LEV_SKIP");return;}
-#define P_LEN 			(path -> sel_length)
-#define P_IND 			(path -> sel_index)
-#define P_ALC 			(path -> prg_allocbits)
-#define P_LEV 			(path -> prg_level)
-#define P_PIND			(path -> prg_index)
-#define P_DATA 			(path -> prg_data)
-#define P_OWNER			(path -> owner)
-#define P_CHILD			(path -> child)
-#define PR_START  		(P_RUNNING -> prg_start)
-#define PR_LEV 			(P_RUNNING -> prg_level)
+static int node_rehash(Dao_vm* vm)
+{
+	unsigned long size = vm -> pool.table_size ? vm -> pool.table_size << 1 : NODE_TABLE_MIN;
+	unsigned long k = 0;
+	Node** table = (Node**)tape_new(vm, TABLE_BITS(size));
+	if (table == NULL)
+		return 0;
+	for (; k < vm -> pool.table_size; k++)
+		while (vm -> pool.table[k] != NULL)
+		{
+			Node* node = vm -> pool.table[k];
+			vm -> pool.table[k] = node->next;
+			node->next = table[node_hash(node->left, node->right, node->cell) & (size - 1)];
+			table[node_hash(node->left, node->right, node->cell) & (size - 1)] = node;
+		}
+	tape_free(vm, (Cell*)vm -> pool.table, TABLE_BITS(vm -> pool.table_size));
+	vm -> pool.table = table;
+	vm -> pool.table_size = size;
+	return 1;
+}
 
-static void swaps(Path path)
+/* Finds the node with these contents, or makes one with no owners yet. */
+static Node* node_find(Dao_vm* vm, Node* left, Node* right, Cell cell)
 {
-	unsigned int i = 0;
-	unsigned long report = 0;
-	levlim(1)
-	verbosely printf("Swapped length %d.", P_LEN);
-	if (P_LEN == 1)	return;
-	if (P_LEN <= BITS_IN_CELL)
-	{
-		unsigned long half_len = P_LEN / 2;
-		write_by_bit_index(path, P_IND, P_LEN, read_by_bit_index(path, P_IND, half_len) | (read_by_bit_index(path, P_IND + half_len, half_len) << half_len));
-		return;
-	}
-	while (i < ((P_LEN / BITS_IN_CELL) / 2))
-	{
-		report = P_DATA[(P_IND / BITS_IN_CELL) + i];
-		P_DATA[(P_IND / BITS_IN_CELL) + i] = P_DATA[(P_IND / BITS_IN_CELL) + ((P_LEN / BITS_IN_CELL) / 2) + i];
-		P_DATA[(P_IND / BITS_IN_CELL) + ((P_LEN / BITS_IN_CELL) / 2) + i++] = report;
-	}
+	Node** bucket;
+	Node* node;
+	if (vm -> pool.node_count >= vm -> pool.table_size && !node_rehash(vm))
+		tape_fail(vm, TABLE_BITS(vm -> pool.table_size << 1) / BITS_IN_BYTE);
+	bucket = &vm -> pool.table[node_hash(left, right, cell) & (vm -> pool.table_size - 1)];
+	for (node = *bucket; node != NULL; node = node->next)
+		if (node->left == left && node->right == right && node->cell == cell)
+			return node;
+	if ((node = vm -> pool.nodes) != NULL)
+		vm -> pool.nodes = node->next;
+	else if ((node = pool_carve(vm, sizeof(Node))) == NULL)
+		tape_fail(vm, sizeof(Node));
+	node->left = left;
+	node->right = right;
+	node->cell = cell;
+	node->refs = 0;
+	node->next = *bucket;
+	*bucket = node;
+	vm -> pool.node_count++;
+	return node;
 }
 
-static void later(Path path)
+static Node* node_retain(Node* node)
 {
-	if (algn(path) || (PR_LEV >= 4))	P_IND += P_LEN;
-	else								merge(path);
+	node->refs++;
+	return node;
 }
 
-static void merge(Path path)
+static Node* node_leaf(Dao_vm* vm, Cell cell)
 {
-	levlim(7)
-	if (P_LEN < P_ALC)
+	return node_retain(node_find(vm, NULL, NULL, cell));
+}
+
+/* Takes over the caller's hold on both halves. */
+static Node* node_cons(Dao_vm* vm, Node* left, Node* right)
+{
+	Node* node = node_find(vm, left, right, 0);
+	if (node->refs++ != 0)										/* Made before, and it already holds its halves		*/
 	{
-		if (!algn(path))
-			P_IND -= P_LEN;
-		P_LEN <<= 1;
-		return;
+		node_release(vm, left);
+		node_release(vm, right);
 	}
-	if (P_OWNER == NULL)
-		return;
-	P_WRITTEN = P_OWNER;
-	(P_WRITTEN->sel_length) = 1;
-	(P_WRITTEN->sel_index) = 1;
+	return node;
 }
 
-static void sifts(Path path)
+static void node_release(Dao_vm* vm, Node* node)
 {
-	int l = P_IND;
-	levlim(5)
-	while (l + 4 < P_ALC)
+	while (node != NULL && --node->refs == 0)
 	{
-		if (!read_by_bit_index(path, l, 4))
-		{
-			int r = l;
-			for (; !read_by_bit_index(path, r, 4) && ((r + 4) < P_ALC); r += 4);			/* OPTIMIZE THIS ASAP */
-			write_by_bit_index(path, l, 4, read_by_bit_index(path, r, 4));
-			write_by_bit_index(path, r, 4, 0);
-		}
-		l += 4;
+		Node* right = node->right;
+		Node** bucket = &vm -> pool.table[node_hash(node->left, node->right, node->cell) & (vm -> pool.table_size - 1)];
+		while (*bucket != node)
+			bucket = &(*bucket)->next;
+		*bucket = node->next;
+		vm -> pool.node_count--;
+		node_release(vm, node->left);
+		node->next = vm -> pool.nodes;
+		vm -> pool.nodes = node;
+		node = right;
 	}
 }
 
-static void execs(Path path, Path caller)
+/* The shared node of 2^level cells all holding cell. */
+static Node* tree_uniform(Dao_vm* vm, Cell cell, unsigned int level)
 {
-	/***************************************************************EXECUTION LOOP***************************************************************/
-	unsigned long tempNum1 = 0;																/* Expedite calculation								*/
-	levlim(8)																				/* Level operation checking							*/
-	P_RUNNING = path;																		/* Set running 										*/
+	Node* node = node_leaf(vm, cell);
+	while (level-- > 0)
+		node = node_cons(vm, node_retain(node), node);
+	return node;
+}
 
-	if (P_CHILD == NULL)																	/* If there is no child 							*/
-	{
-		if ((P_CHILD = (calloc(1, sizeof(struct PATH)))) == NULL)							/* Allocate memory space 							*/
-		{																					/* Cover error case							 		*/
-			printf("FATAL ERROR: Unable to allocate memory.");
-			return;
-		}
-		verbosely printf("Allocated %d bytes.\n\n", sizeof(*P_CHILD));
-		memcpy(P_CHILD, &NEW_PATH, sizeof(struct PATH));									/* Copy over initialization data			 		*/
-		(*(*path).child).owner = path;														/* Set owner of this new Path 						*/
-		(*(*path).child).prg_floor = (path->prg_floor) + 1;									/* Set floor of this new Path 						*/
-		(*(*path).child).prg_data = calloc(1, sizeof(unsigned long));						/* Set data  of this new Path 						*/
-	}
-	else
-		verbosely putchar('\n');
-	P_WRITTEN = P_CHILD;																	/* Set this as written on 							*/
-	P_PIND = (P_IND / 4);																	/* Set program pointer. Rounds down.x				*/
-	PR_START = P_PIND;																		/* Track start position 							*/
+/* Replaces the 2^level cell subtree numbered k with sub, giving back a new tree for the caller to hold. */
+static Node* node_put(Dao_vm* vm, Node* node, unsigned int depth, unsigned long k, unsigned int level, Node* sub)
+{
+	if (depth == level)
+		return sub;
+	if ((k >> (depth - level - 1)) & 1)
+		return node_cons(vm, node_retain(node->left), node_put(vm, node->right, depth - 1, k, level, sub));
+	return node_cons(vm, node_put(vm, node->left, depth - 1, k, level, sub), node_retain(node->right));
+}
 
-	for (; doloop && P_PIND < (P_ALC / 4) && path != NULL && P_WRITTEN != NULL ; P_PIND++)	/* Execution Loop 									*/
-	{
-		tempNum1 = (P_RUNNING->prg_index);
-		command = ((P_RUNNING->prg_data)[(tempNum1 * 4) / 32] >> (32 - ((tempNum1 * 4) % 32) - 4)) & mask(4);	/* Calculate command			*/
-		verbosely diagnose(path, command);
-		
-		if (command == 5)
-			execs(P_WRITTEN, path);
-		else if (command != 0)
-			functions[command](P_WRITTEN);
+static Cell tree_read(Path path, unsigned long k)
+{
+	Node* node = P_TREE;
+	unsigned int depth = tape_class(P_ALC);
+	while (depth-- > 0)
+		node = ((k >> depth) & 1) ? node->right : node->left;
+	return node->cell;
+}
 
-		/*
-		switch(command)
-		{
-		case 0x1: swaps(P_WRITTEN); break;
-		case 0x2: later(P_WRITTEN); break;
-		case 0x3: merge(P_WRITTEN); break;
-		case 0x4: sifts(P_WRITTEN); break;
-		case 0x5: execs(P_WRITTEN, path); break;
-		case 0x6: delev(P_WRITTEN); break;
-		case 0x7: equal(P_WRITTEN); break;
-		case 0x8: halve(P_WRITTEN); break;
-		case 0x9: uplev(P_WRITTEN); break;
-		case 0xA: reads(P_WRITTEN); break;
-		case 0xB: dealc(P_WRITTEN); break;
-		case 0xC: split(P_WRITTEN); break;
-		case 0xD: polar(P_WRITTEN); break;
-		case 0xE: doalc(P_WRITTEN); break;
-		case 0xF: input(P_WRITTEN); break;
-		}
-		*/
-		verbprint("\n");
-	}
-	if (caller == NULL)
-	{
-		verbprint("Top-level program terminated.\n")
-		free(P_CHILD);
-		P_CHILD = NULL;
-		return;
-	}
-	if (!doloop)
-	{
-		verbosely printf("Freed %d bytes.\n\n", sizeof(*P_CHILD));
-		free(P_CHILD);
-		P_CHILD = NULL;
-		doloop = 1;
-	}
-	P_RUNNING = caller;
-	P_WRITTEN = caller->child;
-	return;
+/* The node under a selection of at least one cell. */
+static Node* tree_node(Path path, unsigned long i, unsigned long len)
+{
+	Node* node = P_TREE;
+	unsigned int level = tape_class(len);
+	unsigned int depth = tape_class(P_ALC);
+	unsigned long k = (i / BITS_IN_CELL) >> level;
+	while (depth-- > level)
+		node = ((k >> (depth - level)) & 1) ? node->right : node->left;
+	return node;
 }
 
-static void delev(Path path)
+static void tree_place(Dao_vm* vm, Path path, unsigned long i, unsigned long len, Node* sub)
 {
-	if (PR_LEV > 0) PR_LEV--;
+	unsigned int level = tape_class(len);
+	Node* root = node_put(vm, P_TREE, tape_class(P_ALC), (i / BITS_IN_CELL) >> level, level, sub);
+	node_release(vm, P_TREE);
+	P_TREE = root;
 }
 
-static void equal(Path path)
+static void tree_write(Dao_vm* vm, Path path, unsigned long k, Cell cell)
 {
-	levlim(5)
-	if (read_by_bit_index(path, P_IND, 1) ^ read_by_bit_index(path, P_IND + P_LEN - 1, 1))
-		skip();
-	else
-		verbprint("EQUAL");
+	if (tree_read(path, k) != cell)
+		tree_place(vm, path, k * BITS_IN_CELL, BITS_IN_CELL, node_leaf(vm, cell));
 }
 
-static void halve(Path path)
+static Node* tree_build(Dao_vm* vm, Cell* cells, unsigned long count)
 {
-	levlim(7)
-	if (P_LEN > 1)
-	{
-		P_LEN /= 2;
-		return;
-	}
-	if (P_CHILD == NULL)
-		return;
-	P_WRITTEN = P_CHILD;
-	(P_WRITTEN->sel_length) = (P_WRITTEN->prg_allocbits);
+	if (count == 1)
+		return node_leaf(vm, cells[0]);
+	return node_cons(vm, tree_build(vm, cells, count / 2), tree_build(vm, cells + count / 2, count / 2));
 }
 
-static void uplev(Path path)
+static void tree_convert(Dao_vm* vm, Path path)
 {
-	levlim(9)
-	PR_LEV++;
-	(P_RUNNING->prg_index) = PR_START - 1;
+	Node* root = tree_build(vm, P_DATA, (P_ALC < BITS_IN_CELL) ? 1 : P_ALC / BITS_IN_CELL);
+	tape_release(vm, path);
+	P_TREE = root;
 }
 
-static void reads(Path path)
+static void tree_release(Dao_vm* vm, Path path)
 {
-	long pos = P_IND;
-	levlim(6)
-	if (P_LEN < 8)
+	node_release(vm, P_TREE);
+	P_TREE = NULL;
+}
+
+/*
+* Snapshots. dao_save() writes the state of a paused VM: each PATH of the chain from the root
+* down, with its fields and its tape, then the frames, the steps taken and where stdin and
+* stdout were, so dao_restore() can carry on from the same step in another process. Tapes
+* are written in file order, a byte at a time, so a snapshot does not depend on CELL_BITS,
+* as runs of zero bytes followed by literal bytes; pages of a sparse tape and subtrees that
+* hold only zeros are written as runs without being read. Numbers are big-endian.
+*
+* Where a regular file on stdin or stdout was is kept as its device, inode and offset, so a
+* resumed run reads on from the same byte of the same file and writes again what it printed
+* after the snapshot there, wherever either started; a run appending to a log leaves what came
+* before it alone. Any other stdin or stdout, or another file, is taken as it is.
+*
+* dao_freeze() writes the same thing as a warm-start image, taken where a program first stops
+* at INPUT, along with what it printed before: restoring it skips the setup that does not
+* depend on input, and starts a run afresh on whatever stdin and stdout are at the time.
+*
+*	8	magic		SNAP_MAGIC, whose last byte is the version
+*	4	paths		PATHs in the chain; a PATH's index is its prg_floor
+*	4	frames		entries of the frame stack
+*	4	running		index + 1 of P_RUNNING, 0 if none
+*	4	written		index + 1 of P_WRITTEN
+*	1	doloop
+*	1	frozen		1 for an image from dao_freeze()
+*	8	ran			steps taken
+*	24	input		device, inode and offset of the next byte of stdin, or zeros
+*	24	output		device, inode and offset of the next byte of stdout, or zeros
+*	4	pending		bytes read ahead of INPUT, then those bytes
+*	8	prologue	bytes of READS a frozen image writes first, then those bytes
+*	...	each PATH: owner + 1 (4), child + 1 (4), prg_allocbits, prg_index (8), prg_level (1),
+*		sel_length, sel_index (8), prg_floor (4), prg_start (8), tape kind (1), then the runs of
+*		its tape: zero bytes (8), literal bytes (4), the literal bytes, until the tape is covered
+*	...	each frame: path + 1 (4), caller + 1 (4)
+*/
+#define SNAP_MAGIC		"DAOSNAP\003"
+#define SNAP_LITERAL	(64 * 1024)				/* Literal bytes gathered before a run is written */
+#define SNAP_ZEROS		16						/* Zero bytes that end a literal run */
+
+#define SNAP_FLAT		0						/* Tape kinds */
+#define SNAP_PAGES		1
+#define SNAP_TREE		2
+
+typedef struct SNAP
+{
+	FILE*			file;						/* SNAPSHOT   FILE    */
+	int				fine;						/* NO ERROR   YET     */
+	unsigned long long	zeros;					/* ZEROS   BEFORE LIT */
+	size_t			used;						/* LITERAL    BYTES   */
+	size_t			tail;						/* ZEROS   ENDING LIT */
+	unsigned char	literal[SNAP_LITERAL];		/* LITERAL    RUN     */
+} Snap;
+
+static void snap_number(Snap* snap, unsigned long long number, unsigned int count)
+{
+	unsigned char bytes[8];
+	unsigned int b;
+	for (b = 0; b < count; b++)
+		bytes[b] = (unsigned char)(number >> (8 * (count - 1 - b)));
+	snap->fine = snap->fine && fwrite(bytes, 1, count, snap->file) == count;
+}
+
+static unsigned long long snap_read(FILE* file, unsigned int count, int* fine)
+{
+	unsigned char bytes[8];
+	unsigned long long number = 0;
+	unsigned int b;
+	if (fread(bytes, 1, count, file) != count)
 	{
-		char* out = bin(read_by_bit_index(path, pos, P_LEN));
-		printf("%s", &out[strlen(out) - P_LEN]);
-		return;
+		*fine = 0;
+		return 0;
 	}
-	for (; pos < (P_IND + P_LEN); pos += 8)
-		putchar(read_by_bit_index(path, pos, 8));
+	for (b = 0; b < count; b++)
+		number = (number << 8) | bytes[b];
+	return number;
 }
 
-static void dealc(Path path)
+/* Writes the zeros and the literal gathered so far, less the zeros ending it, which start the next run. */
+static void snap_run(Snap* snap)
 {
-	levlim(2)
-	if (P_ALC == 1)
-	{
-		int report = read_by_bit_index(path, 0, 1);
-		if ((P_RUNNING->owner) != NULL)
-		{
-			unsigned long ownind = ((P_RUNNING->owner)->prg_index);
-			verbosely printf("Terminating program from position %x with value %x", ownind, report);
-			write_by_bit_index(P_RUNNING->owner, (ownind) * 4, 4, report);
-		}
-		free(P_DATA);
-		P_DATA = NULL;
-		doloop = 0;
+	size_t count = snap->used - snap->tail;
+	if (snap->zeros == 0 && count == 0)
 		return;
-	}
-	P_ALC >>= 1;
-	if (P_ALC <= 8)
-		realloc(P_DATA, 1);
-	else
-		realloc(P_DATA, P_ALC / 8);
-	if (P_LEN > 1)
-		halve(path);
-	if ((P_IND + P_LEN) > P_ALC)
-		P_IND -= P_ALC;
+	snap_number(snap, snap->zeros, 8);
+	snap_number(snap, count, 4);
+	snap->fine = snap->fine && fwrite(snap->literal, 1, count, snap->file) == count;
+	snap->zeros = snap->tail;
+	snap->used = snap->tail = 0;
+}
+
+static void snap_zeros(Snap* snap, unsigned long long count)
+{
+	if (snap->used > 0)
+		snap_run(snap);
+	snap->zeros += count;
 }
 
-static void split(Path path)
+static void snap_bytes(Snap* snap, const unsigned char* bytes, size_t count)
 {
-	if (PR_LEV < 1)
+	for (; count > 0; count--, bytes++)
 	{
-		unsigned int len = P_LEN;
-		if (len == 1)
-		{
-			if (P_CHILD == NULL)
-				return;
-			P_WRITTEN = P_CHILD;
-			(P_WRITTEN->sel_length) = (P_WRITTEN->prg_allocbits);
-			split(P_WRITTEN);
-			halve(P_WRITTEN);
-			return;
-		}
-		if (len <= BITS_IN_CELL)
-		{
-			write_by_bit_index(path, P_IND, len >> 1, mask(len));
-			write_by_bit_index(path, P_IND + (len >> 1), len >> 1, ~mask(len));
-		}
-		else
+		if (snap->used == SNAP_LITERAL)
+			snap_run(snap);
+		if (snap->used == 0 && *bytes == 0)
 		{
-			unsigned int leftIndex = (P_IND / BITS_IN_CELL);
-			unsigned int rightIndex = leftIndex + (len / BITS_IN_CELL) - 1;
-			while (leftIndex < rightIndex)
-			{
-				P_DATA[leftIndex++] = 0xFFFFFFFF;
-				P_DATA[rightIndex--] = 0;
-			}
+			snap->zeros++;
+			continue;
 		}
+		snap->literal[snap->used++] = *bytes;
+		snap->tail = (*bytes == 0) ? snap->tail + 1 : 0;
+		if (snap->tail == SNAP_ZEROS)
+			snap_run(snap);
 	}
-	halve(path);
 }
 
-static void polar(Path path)
+/* Ends a tape: the literal goes out, then the zeros after it as a run of their own. */
+static void snap_end(Snap* snap)
 {
-	levlim(3)
-	if (!(read_by_bit_index(path, P_IND, 1) && !read_by_bit_index(path, P_IND + P_LEN - 1, 1)))
-		skip();
-	else
-		verbprint("POLAR");
+	snap_run(snap);
+	snap_run(snap);
 }
 
-static void doalc(Path path)
+/* True if the 2^level cells under node are all zero. */
+static int snap_zero_tree(Node* node, unsigned int level)
 {
-	unsigned long new_cell_count = 0;
-	unsigned long* new_data_pointer = NULL;
-	levlim(1)
-		P_ALC <<= 1;
+	for (; level > 0; level--, node = node->left)
+		if (node->left != node->right)
+			return 0;
+	return node->cell == 0;
+}
 
-	if (P_ALC <= BITS_IN_CELL)
-		new_cell_count = BITS_IN_CELL / BITS_IN_BYTE;
+static void snap_tree(Snap* snap, Node* node, unsigned int level, size_t bytes)
+{
+	if (snap_zero_tree(node, level))
+		snap_zeros(snap, bytes);
+	else if (level == 0)
+		snap_bytes(snap, (unsigned char*)&node->cell, bytes);
 	else
-		new_cell_count = P_ALC / BITS_IN_BYTE;
-
-	new_cell_count /= sizeof(unsigned long);
-
-	printf("");
-
-	if ((new_data_pointer = calloc(new_cell_count, sizeof(unsigned long))) == NULL)
 	{
-		printf("Error allocating %d bytes: ", new_cell_count * sizeof(unsigned long));
-		perror("");
-		if (SKIP_OVERFLOW)
-			return;
-		abort();
+		snap_tree(snap, node->left, level - 1, bytes / 2);
+		snap_tree(snap, node->right, level - 1, bytes / 2);
 	}
+}
 
-	if (new_cell_count > 1)
-		memcpy(new_data_pointer, P_DATA, new_cell_count * sizeof(unsigned long) / 2);
+/* Bytes of a tape in a snapshot: its bits, or one byte for less than a byte. */
+static size_t snap_tape_bytes(unsigned long bits)
+{
+	return (bits < BITS_IN_BYTE) ? 1 : bits / BITS_IN_BYTE;
+}
+
+static void snap_path(Snap* snap, Path path)
+{
+	unsigned long k;
+	size_t bytes = snap_tape_bytes(P_ALC), part;
+	snap_number(snap, P_OWNER != NULL ? P_OWNER->prg_floor + 1 : 0, 4);
+	snap_number(snap, P_CHILD != NULL ? P_CHILD->prg_floor + 1 : 0, 4);
+	snap_number(snap, P_ALC, 8);
+	snap_number(snap, P_PIND, 8);
+	snap_number(snap, P_LEV, 1);
+	snap_number(snap, P_LEN, 8);
+	snap_number(snap, P_IND, 8);
+	snap_number(snap, path->prg_floor, 4);
+	snap_number(snap, path->prg_start, 8);
+	snap_number(snap, P_TREE != NULL ? SNAP_TREE : P_PAGES != NULL ? SNAP_PAGES : SNAP_FLAT, 1);
+	if (P_TREE != NULL)
+		snap_tree(snap, P_TREE, tape_class(P_ALC), bytes);
+	else if (P_PAGES != NULL)
+		for (k = 0; k < sparse_pages(P_ALC); k++)
+		{
+			Page page = P_PAGES[k / LEAF_PAGES][k % LEAF_PAGES];
+			part = (bytes < PAGE_BYTES) ? bytes : PAGE_BYTES;		/* A tape shrunk below a page has part of one	*/
+			if (page == zero_page)								/* Never written: no need to look			*/
+				snap_zeros(snap, part);
+			else
+				snap_bytes(snap, (unsigned char*)page, part);
+		}
 	else
-		memcpy(new_data_pointer, P_DATA, sizeof(unsigned long));
+		snap_bytes(snap, (unsigned char*)P_DATA, bytes);
+	snap_end(snap);
+}
 
-	P_DATA = new_data_pointer;
+/* Writes count bytes at offset into a tape of any kind; cells are in file order, so bytes go straight in. */
+static void snap_put(Dao_vm* vm, Path path, size_t offset, const unsigned char* bytes, size_t count)
+{
+	if (P_DATA != NULL)
+	{
+		memcpy((unsigned char*)P_DATA + offset, bytes, count);
+		return;
+	}
+	while (count > 0)
+	{
+		unsigned long k = offset / sizeof(Cell);
+		size_t at = offset % sizeof(Cell);
+		size_t part = (sizeof(Cell) - at < count) ? sizeof(Cell) - at : count;
+		Cell cell = P_CELL(k);
+		memcpy((unsigned char*)&cell + at, bytes, part);
+		if (P_TREE != NULL)
+			tree_write(vm, path, k, cell);
+		else
+			P_CELL_REF(k) = cell;
+		offset += part;
+		bytes += part;
+		count -= part;
+	}
+}
 
-	merge(path);
+/* Reads the PATH numbered index of paths into path, which has no tape yet. */
+static int snap_load(Dao_vm* vm, FILE* file, Path path, unsigned long index, unsigned long paths, unsigned char* literal)
+{
+	int fine = 1;
+	unsigned long owner = (unsigned long)snap_read(file, 4, &fine);
+	unsigned long child = (unsigned long)snap_read(file, 4, &fine);
+	unsigned long long bits = snap_read(file, 8, &fine), zeros, size;
+	size_t bytes, at = 0;
+	unsigned int kind;
+	P_PIND = (unsigned long)snap_read(file, 8, &fine);
+	P_LEV = (unsigned char)snap_read(file, 1, &fine);
+	P_LEN = (unsigned long)snap_read(file, 8, &fine);
+	P_IND = (unsigned long)snap_read(file, 8, &fine);
+	path->prg_floor = (unsigned int)snap_read(file, 4, &fine);
+	path->prg_start = (unsigned long)snap_read(file, 8, &fine);
+	kind = (unsigned int)snap_read(file, 1, &fine);
+	if (!fine || owner != index || child != ((index + 1 < paths) ? index + 2 : 0) || path->prg_floor != index
+		|| bits == 0 || (bits & (bits - 1)) != 0 || (unsigned long)bits != bits || P_LEV >= 10 || P_LEN > bits || P_IND > bits)
+		return 0;
+	P_ALC = (unsigned long)bits;
+	if (kind == SNAP_TREE)
+		P_TREE = tree_uniform(vm, 0, tape_class(P_ALC));
+	else if (kind == SNAP_PAGES && tape_bytes(P_ALC) >= PAGE_BYTES)
+	{
+		if (!sparse_new(vm, path, P_ALC))
+			return 0;
+	}
+	else if (kind > SNAP_PAGES || tape_alloc(vm, path, P_ALC) == NULL)	/* Less than a page comes back flat		*/
+		return 0;
+	for (bytes = snap_tape_bytes(P_ALC); at < bytes; at += (size_t)size)
+	{
+		zeros = snap_read(file, 8, &fine);
+		size = snap_read(file, 4, &fine);
+		if (!fine || (zeros == 0 && size == 0) || zeros > bytes - at || size > bytes - at - zeros || size > SNAP_LITERAL
+			|| fread(literal, 1, (size_t)size, file) != size)
+			return 0;
+		at += (size_t)zeros;
+		snap_put(vm, path, at, literal, (size_t)size);
+	}
+	return 1;
 }
 
-static void input(Path path)
+/* Writes where the next byte of stream is, back bytes before its offset, if it is a regular file. */
+static void snap_where(Snap* snap, FILE* stream, size_t back)
 {
-	int i = P_IND;
-	levlim(6)
-	if (P_LEN < 8)
+#if !defined(_WIN32)
+	struct stat st;
+	off_t at = -1;
+	if (stream != NULL && fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode))
+		at = (fcntl(fileno(stream), F_GETFL) & O_APPEND) ? st.st_size : ftello(stream);	/* Appends go at the end, wherever the offset is */
+	if (at >= (off_t)back)
 	{
-		write_by_bit_index(path, P_IND, P_LEN, getchar());
+		snap_number(snap, (unsigned long long)st.st_dev, 8);
+		snap_number(snap, (unsigned long long)st.st_ino, 8);
+		snap_number(snap, (unsigned long long)(at - back), 8);
 		return;
 	}
-	for (; i < (P_IND + P_LEN); i += 8)
-		write_by_bit_index(path, i, 8, getchar());
+#endif
+	snap_number(snap, 0, 8);
+	snap_number(snap, 0, 8);
+	snap_number(snap, 0, 8);
 }
 
-/***
- *    oooooooooooo ooooooooooooo   .oooooo.   
- *    `888'     `8 8'   888   `8  d8P'  `Y8b  
- *     888              888      888          
- *     888oooo8         888      888          
- *     888    "         888      888          
- *     888       o      888      `88b    ooo  
- *    o888ooooood8     o888o      `Y8bood8P'  
- *                                            
- *                                            
- *                                            
- */
+/* Writes vm to name; a frozen image has said, count bytes of output to write again. */
+static int snap_save(Dao_vm* vm, const char* name, const char* said, size_t count, int frozen)
+{
+	char* temp = malloc(strlen(name) + 8);
+	Snap* snap = malloc(sizeof(Snap));
+	Path path;
+	unsigned long paths = 0, k;
+	size_t pending = (vm -> in_ready == 2) ? 0 : (size_t)(vm -> in_end - vm -> in_next);	/* Mapped input is found again by its offset */
+	int fine = 0;
+	if (temp == NULL || snap == NULL || !vm -> root_bytes)
+		goto done;
+	for (path = &vm -> root; path != NULL; path = P_CHILD)
+		if (path->prg_floor != paths++)							/* Floors number the chain from the root		*/
+			goto done;
+	out_flush(vm);
+	sprintf(temp, "%s.new", name);
+	if ((snap->file = fopen(temp, "wb")) == NULL)
+		goto done;
+	snap->fine = fwrite(SNAP_MAGIC, 1, 8, snap->file) == 8;
+	snap->zeros = snap->used = snap->tail = 0;
+	snap_number(snap, paths, 4);
+	snap_number(snap, vm -> frame_count, 4);
+	snap_number(snap, (vm -> frame_count && P_RUNNING != NULL) ? P_RUNNING->prg_floor + 1 : 0, 4);	/* Left over once the program is done */
+	snap_number(snap, (vm -> frame_count && P_WRITTEN != NULL) ? P_WRITTEN->prg_floor + 1 : 0, 4);
+	snap_number(snap, vm -> doloop != 0, 1);
+	snap_number(snap, frozen, 1);
+	snap_number(snap, vm -> ran, 8);
+	snap_where(snap, (frozen || vm -> read != NULL) ? NULL : stdin, (size_t)(vm -> in_end - vm -> in_next));	/* Read ahead, but not taken */
+	snap_where(snap, (frozen || vm -> write != NULL) ? NULL : stdout, 0);
+	snap_number(snap, pending, 4);
+	snap->fine = snap->fine && fwrite(vm -> in_next, 1, pending, snap->file) == pending;
+	snap_number(snap, count, 8);
+	snap->fine = snap->fine && (count == 0 || fwrite(said, 1, count, snap->file) == count);
+	for (path = &vm -> root; path != NULL; path = P_CHILD)
+		snap_path(snap, path);
+	for (k = 0; k < vm -> frame_count; k++)
+	{
+		snap_number(snap, vm -> frames[k].path->prg_floor + 1, 4);
+		snap_number(snap, vm -> frames[k].caller != NULL ? vm -> frames[k].caller->prg_floor + 1 : 0, 4);
+	}
+	fine = snap->fine && fflush(snap->file) == 0;
+#if !defined(_WIN32)
+	fine = fine && fsync(fileno(snap->file)) == 0;				/* On disk before it replaces the last one		*/
+#else
+	remove(name);
+#endif
+	fine = (fclose(snap->file) == 0) && fine;
+	if (!fine || rename(temp, name) != 0)
+	{
+		remove(temp);
+		fine = 0;
+	}
+done:
+	free(temp);
+	free(snap);
+	return fine ? 0 : DAO_ERROR;
+}
 
-char algn(Path path)
+int dao_save(Dao_vm* vm, const char* name)
 {
-	return P_IND % (P_LEN << 1) == 0;
+	return snap_save(vm, name, NULL, 0, 0);
 }
 
-unsigned long mask(int length)
+typedef struct SAID
+{
+	char*			bytes;						/* OUTPUT     SO FAR  */
+	size_t			used;						/* BYTES   IN BYTES   */
+	size_t			alloc;						/* BYTES   ALLOCATED  */
+	int				fine;						/* ALL     KEPT       */
+} Said;
+
+/* Stands in for stdin while freezing: no input ever comes, so the run waits at the first INPUT. */
+static size_t freeze_read(void* user, unsigned char* bytes, size_t count)
 {
-	if (length < BITS_IN_CELL)	return ((int)1 << length) - 1;
-	else			 	return 0xFFFFFFFF;
+	(void)user; (void)bytes; (void)count;
+	return DAO_AGAIN;
 }
 
-unsigned long read_by_bit_index(Path path, unsigned long i, unsigned long len)
+static void freeze_write(void* user, const char* bytes, size_t count)
 {
-	return (P_DATA[i / BITS_IN_CELL] >> (BITS_IN_CELL - (i % BITS_IN_CELL) - len)) & mask(len);
+	Said* said = user;
+	if (said->used + count > said->alloc)
+	{
+		size_t alloc = (said->alloc ? said->alloc : OUT_BYTES);
+		char* grown;
+		while (alloc < said->used + count)
+			alloc *= 2;
+		if ((grown = realloc(said->bytes, alloc)) == NULL)
+		{
+			said->fine = 0;
+			return;
+		}
+		said->bytes = grown;
+		said->alloc = alloc;
+	}
+	memcpy(said->bytes + said->used, bytes, count);
+	said->used += count;
 }
 
-static void write_by_bit_index(Path path, unsigned long i, unsigned long len, unsigned long write)
+int dao_freeze(Dao_vm* vm, const char* name)
 {
-	int shift = BITS_IN_CELL - (i % BITS_IN_CELL) - len;
-	if (len > BITS_IN_CELL) abort();
-	P_DATA[i / BITS_IN_CELL] &= ~(mask(len) << shift);
-	P_DATA[i / BITS_IN_CELL] |= ((write & mask(len)) << shift);
+	Said said = { NULL, 0, 0, 1 };
+	Dao_read read = vm -> read;
+	Dao_write write = vm -> write;
+	void* user = vm -> user;
+	char bulk = vm -> in_bulk;
+	int status, saved;
+	if (!vm -> root_bytes)
+		return DAO_ERROR;
+	dao_io(vm, freeze_read, freeze_write, &said);
+	status = dao_run(vm, 0);									/* Up to the first INPUT, or the end			*/
+	dao_io(vm, read, write, user);
+	vm -> in_bulk = bulk;
+	saved = said.fine ? snap_save(vm, name, said.bytes, said.used, 1) : DAO_ERROR;
+	if (saved == 0 && said.used > 0)
+		out_write(vm, said.bytes, said.used);					/* This run goes on as if it had printed it	*/
+	free(said.bytes);
+	return saved != 0 ? DAO_ERROR : (status == DAO_WAITING) ? DAO_PAUSED : status;
 }
 
-static void bin_print(Path path)
+int dao_restore(Dao_vm* vm, const char* name)
+{
+	FILE* file = fopen(name, "rb");
+	unsigned char magic[8];
+	unsigned char* literal = malloc(SNAP_LITERAL);
+	unsigned long paths, frames, running, written, pending, k;
+	unsigned long long where[6], said;
+	char* prologue = NULL;
+	Path* chain = NULL;
+	Path path;
+	int fine = 1, doloop, frozen;
+	if (vm -> root_bytes)
+		interpret_end(vm);
+	if (file == NULL || literal == NULL || fread(magic, 1, 8, file) != 8 || memcmp(magic, SNAP_MAGIC, 8) != 0)
+		goto fail;
+	paths = (unsigned long)snap_read(file, 4, &fine);
+	frames = (unsigned long)snap_read(file, 4, &fine);
+	running = (unsigned long)snap_read(file, 4, &fine);
+	written = (unsigned long)snap_read(file, 4, &fine);
+	doloop = (int)snap_read(file, 1, &fine);
+	frozen = (int)snap_read(file, 1, &fine);
+	vm -> ran = snap_read(file, 8, &fine);
+	for (k = 0; k < 6; k++)
+		where[k] = snap_read(file, 8, &fine);					/* stdin, then stdout: device, inode, offset	*/
+	pending = (unsigned long)snap_read(file, 4, &fine);
+	in_unmap(vm);												/* stdin is found again from where it was		*/
+	vm -> in_next = vm -> in_end = vm -> in_block;
+	if (!fine || paths == 0 || running > paths || written > paths || in_room(vm, pending) == NULL
+		|| fread(vm -> in_next, 1, pending, file) != pending)
+		goto fail;
+	said = snap_read(file, 8, &fine);
+	if (!fine || (size_t)said != said || (said > 0 && (prologue = malloc((size_t)said)) == NULL)
+		|| fread(prologue, 1, (size_t)said, file) != said || (chain = malloc(paths * sizeof(Path))) == NULL)
+		goto fail;
+	vm -> root = NEW_PATH;
+	vm -> root_bytes = 1;										/* Whatever is built is freed on failure		*/
+	for (k = 0; k < paths; k++)
+	{
+		if (k == 0)
+			chain[k] = &vm -> root;
+		else if ((chain[k] = chain[k - 1]->child = path_new(vm, chain[k - 1])) == NULL)
+			goto fail;
+		else
+			tape_release(vm, chain[k]);
+		if (!snap_load(vm, file, chain[k], k, paths, literal))
+			goto fail;
+	}
+	for (k = 0; k < frames; k++)
+	{
+		unsigned long at = (unsigned long)snap_read(file, 4, &fine), caller = (unsigned long)snap_read(file, 4, &fine);
+		if (vm -> frame_count == vm -> frame_alloc)
+		{
+			Frame* grown = realloc(vm -> frames, (vm -> frame_alloc ? vm -> frame_alloc * 2 : 64) * sizeof(Frame));
+			if (grown == NULL)
+				goto fail;
+			vm -> frames = grown;
+			vm -> frame_alloc = vm -> frame_alloc ? vm -> frame_alloc * 2 : 64;
+		}
+		if (!fine || at == 0 || at > paths || caller > paths)
+			goto fail;
+		vm -> frames[k].path = chain[at - 1];
+		vm -> frames[k].caller = caller ? chain[caller - 1] : NULL;
+		vm -> frame_count++;
+	}
+	path = &vm -> root;
+	vm -> root_bytes = tape_bytes(P_ALC);
+	P_RUNNING = running ? chain[running - 1] : NULL;
+	P_WRITTEN = written ? chain[written - 1] : NULL;
+	OPS = functions[P_RUNNING != NULL ? PR_LEV : 0];
+	vm -> doloop = doloop;
+	vm -> memo_frame = 0;										/* A run being remembered is just run			*/
+	vm -> memo_pure = 0;
+	vm -> in_end = vm -> in_next + pending;
+	vm -> in_ready = 0;
+	vm -> in_bulk = vm -> in_bulk || pending > 0;				/* Bytes read ahead are taken before stdin's	*/
+	vm -> out_lines = FLUSH_LINES || (vm -> write == NULL && isatty(fileno(stdout)));
+#if !defined(_WIN32)
+	if (!frozen)												/* A frozen image starts on them as they are	*/
+	{
+		struct stat st;
+		if (vm -> read == NULL && where[1] != 0 && fstat(0, &st) == 0 && S_ISREG(st.st_mode)
+			&& (unsigned long long)st.st_dev == where[0] && (unsigned long long)st.st_ino == where[1]
+			&& fseeko(stdin, (off_t)where[2], SEEK_SET) == 0)
+			vm -> in_end = vm -> in_next;						/* The same file is read again from where it was	*/
+		if (vm -> write == NULL && where[4] != 0 && fstat(1, &st) == 0 && S_ISREG(st.st_mode)
+			&& (unsigned long long)st.st_dev == where[3] && (unsigned long long)st.st_ino == where[4]
+			&& (unsigned long long)st.st_size > where[5])
+		{
+			fflush(stdout);										/* Output since the snapshot is written again	*/
+			if (ftruncate(1, (off_t)where[5]) == 0)
+				fseeko(stdout, (off_t)where[5], SEEK_SET);
+		}
+	}
+#endif
+	if (said > 0)
+		out_write(vm, prologue, (size_t)said);
+	fclose(file);
+	free(literal);
+	free(prologue);
+	free(chain);
+	return 0;
+fail:
+	if (vm -> root_bytes)
+		interpret_end(vm);
+	if (file != NULL)
+		fclose(file);
+	free(literal);
+	free(prologue);
+	free(chain);
+	return DAO_ERROR;
+}
+
+static void bin_print(Dao_vm* vm, Path path)
 {
 	unsigned long c_ind = 0;
-	unsigned long c_num = P_ALC / BITS_IN_CELL;
+	unsigned long c_num = P_ALC / BITS_IN_WORD;
 	unsigned long empty_lines = 0;
 	unsigned char j = 0;
 	char* out;
-	/* One or less cells */
+	/* One or less words */
 	if (c_num <= 1)
 	{
-		out = bin(read_by_bit_index(path, 0, P_ALC));
+		out = bin(vm, read_by_bit_index(path, 0, P_ALC));
 		printf("%s", &out[strlen(out) - P_ALC]);
 		return;
 	}
 	/* One or less lines */
 	if (c_num <= 4 || PRINT_EVERYTHING)
 	{
-		/* For each cell */
+		/* For each word */
 		for (; c_ind < c_num; c_ind++)
 		{
 			/* Print the contents */
-			printf("%s", l_to_str(P_DATA[c_ind], 8, 16, 0));
+			printf("%s", l_to_str(vm, P_WORD(c_ind), 8, 16, 0));
 
 			/* If not the last index of a line */
 			if ((c_ind + 1) % 4 != 0)
@@ -1320,7 +4473,7 @@ static void bin_print(Path path)
 		
 		/* If line is not all zeroes      */
 		/* That is: If any are not zeroes */
-		if (P_DATA[c_ind] || P_DATA[c_ind+1] || P_DATA[c_ind+2] || P_DATA[c_ind+3])
+		if (P_WORD(c_ind) || P_WORD(c_ind+1) || P_WORD(c_ind+2) || P_WORD(c_ind+3))
 		{
 
 			/* See if we have backlogged empty lines */
@@ -1328,7 +4481,7 @@ static void bin_print(Path path)
 			{
 				if (empty_lines > 1)
 				{
-					out = str_dup(l_to_str(32 * empty_lines, 6, 10, 1));
+					out = str_dup(l_to_str(vm, 32 * empty_lines, 6, 10, 1));
 					for (j = 0; j < strlen(out) && out[j] == '0'; j++)
 							out[j] = ' ';
 					printf(".         %s n x 0            .", out);
@@ -1346,10 +4499,10 @@ static void bin_print(Path path)
 
 			/* Print this line */
 			
-			printf("%s ", l_to_str(P_DATA[c_ind  ], 8, 16, 0));
-			printf("%s ", l_to_str(P_DATA[c_ind+1], 8, 16, 0));
-			printf("%s ", l_to_str(P_DATA[c_ind+2], 8, 16, 0));
-			printf("%s" , l_to_str(P_DATA[c_ind+3], 8, 16, 0));
+			printf("%s ", l_to_str(vm, P_WORD(c_ind  ), 8, 16, 0));
+			printf("%s ", l_to_str(vm, P_WORD(c_ind+1), 8, 16, 0));
+			printf("%s ", l_to_str(vm, P_WORD(c_ind+2), 8, 16, 0));
+			printf("%s" , l_to_str(vm, P_WORD(c_ind+3), 8, 16, 0));
 
 			/* Newline and indent if not last line */
 			if ((c_ind + 4) < c_num)
@@ -1364,7 +4517,7 @@ static void bin_print(Path path)
 		{
 			if (empty_lines > 1)
 			{
-				out = str_dup(l_to_str(32 * empty_lines, 6, 10, 1));
+				out = str_dup(l_to_str(vm, 32 * empty_lines, 6, 10, 1));
 				for (j = 0; j < strlen(out) && out[j] == '0'; j++)
 						out[j] = ' ';
 				printf(".         %s n x 0            .", out);
@@ -1380,43 +4533,45 @@ static void bin_print(Path path)
 	}
 }
 
-static void rad_print(Path path, unsigned int radix)
+#if !defined(DAO_LIBRARY)
+static void rad_print(Dao_vm* vm, Path path, unsigned int radix)
 {
 	unsigned long i = 0;
 	unsigned char len = 0;
 	char* out;
 	for (; radix >> len != 0; len++);
-	len = 32 / len;
-	if (P_ALC <= BITS_IN_CELL)
+	len = BITS_IN_WORD / len;
+	if (P_ALC <= BITS_IN_WORD)
 	{
-		out = l_to_str(read_by_bit_index(path, 0, P_ALC), 32, 2, 1);
+		out = l_to_str(vm, read_by_bit_index(path, 0, P_ALC), 32, 2, 1);
 		printf("%s", &out[strlen(out) - P_ALC]);
 	}
-	while (i < (P_ALC / BITS_IN_CELL))
+	while (i < (P_ALC / BITS_IN_WORD))
 	{
-		out = l_to_str(P_DATA[i], len, radix, 1);
+		out = l_to_str(vm, P_WORD(i), len, radix, 1);
 		printf("%s", out);
-		if (i++ < (P_ALC / BITS_IN_CELL))
+		if (i++ < (P_ALC / BITS_IN_WORD))
 			putchar(' ');
 	}
 }
+#endif
 
-static void skip()
+static void skip(Dao_vm* vm)
 {
 	if (P_RUNNING == NULL) return;
 	verbprint("SKIP");
 	(P_RUNNING->prg_index)++;
 }
 
-static void diagnose(Path path, unsigned char command)
+static void diagnose(Dao_vm* vm, Path path, unsigned char command)
 {
-	printf("%s " , l_to_str(P_PIND, 5, 16, 1));
+	printf("%s " , l_to_str(vm, P_PIND, 5, 16, 1));
 	printf("R%d ", (P_RUNNING->prg_floor));
 	printf("W%d ", (P_WRITTEN->prg_floor));
 	printf("L%d ", PR_LEV);
-	printf("*%s ", l_to_str(P_LEN, 5, 10, 1));
+	printf("*%s ", l_to_str(vm, P_LEN, 5, 10, 1));
 	printf("%c " , getChar(command));
 	if (!HIDE_DATA)
-		bin_print(P_WRITTEN);
+		bin_print(vm, P_WRITTEN);
 	printf(" : ");
-}
\ No newline at end of file
+}
@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# Runs the samples here and compares what they print: sh check.sh <directory with daox and dao>
+#
+# Each <name>.dao with a <name>.expected is run on <name>.input, or on no input, by daox and by
+# dao under each engine flag, and must print exactly <name>.expected. With -j it is run again
+# from a copy padded past two COMPILE_CHUNKs, so the source is compiled in chunks. Each is also
+# saved every few steps with flat, page and tree tapes, and the last snapshot resumed into the
+# same output, appended to a log that must keep what was there before. Each <name>.prompt is
+# typed at the prompt of daox run with no file, and it must show exactly <name>.shown. Last, a
+# dao --serve is started and serve.py sends it jobs, if python3 is there.
+
+bin=$(cd "${1:-../../c}" && pwd)
+tests=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+run=0
+
+for expected in "$tests"/*.expected; do
+	name=$(basename "$expected" .expected)
+	input=/dev/null
+	[ -f "$tests/$name.input" ] && input="$tests/$name.input"
+	{
+		i=0
+		while [ $i -lt 40000 ]; do
+			echo "@ Padding that is all comment, so chunk ends fall inside comments and code alike"
+			i=$((i + 1))
+		done
+		cat "$tests/$name.dao"
+	} > "$work/$name.dao"
+	for flag in "" -t -z -b -m -j; do
+		source="$tests/$name.dao"
+		[ "$flag" = -j ] && source="$work/$name.dao"
+		for command in "$bin/daox $source -n $flag" "$bin/dao $source $flag"; do
+			run=$((run + 1))
+			if ! $command < "$input" > "$work/out" 2>&1 || ! cmp -s "$work/out" "$expected"; then
+				echo "FAIL $command"
+				failed=$((failed + 1))
+			fi
+		done
+	done
+done
+for typed in "$tests"/*.prompt; do
+	name=$(basename "$typed" .prompt)
+	run=$((run + 1))
+	if ! "$bin/daox" < "$typed" > "$work/out" 2>&1 || ! cmp -s "$work/out" "$tests/$name.shown"; then
+		echo "FAIL $bin/daox < $name.prompt"
+		failed=$((failed + 1))
+	fi
+done
+echo "samples: $failed of $run failed"
+
+snapped=$failed
+run=0
+for expected in "$tests"/*.expected; do
+	name=$(basename "$expected" .expected)
+	input=/dev/null
+	[ -f "$tests/$name.input" ] && input="$tests/$name.input"
+	for flag in "" -z -b; do
+		for every in 1 5 40; do
+			run=$((run + 1))
+			rm -f "$work/snap"
+			echo "An earlier run" > "$work/out"
+			"$bin/dao" "$tests/$name.dao" $flag --checkpoint-every $every --checkpoint-file "$work/snap" < "$input" >> "$work/out" 2>&1
+			[ -f "$work/snap" ] && "$bin/dao" --resume "$work/snap" $flag < "$input" >> "$work/out" 2>&1
+			if ! { echo "An earlier run"; cat "$expected"; } | cmp -s - "$work/out"; then
+				echo "FAIL $name $flag resumed from every $every steps"
+				failed=$((failed + 1))
+			fi
+		done
+	done
+done
+echo "snapshots: $((failed - snapped)) of $run failed"
+
+if command -v python3 > /dev/null; then
+	"$bin/dao" --serve "$work/socket" > /dev/null &
+	server=$!
+	i=0
+	while [ ! -S "$work/socket" ] && [ $i -lt 50 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+	python3 "$tests/serve.py" "$work/socket" "$tests" || failed=$((failed + 1))
+	kill $server
+	wait $server 2> /dev/null
+fi
+
+[ $failed -eq 0 ]
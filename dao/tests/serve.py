@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+#
+# A scripted client for dao --serve: python3 serve.py <socket> <tests>
+#
+# Sends jobs over one connection, one after another, and checks each reply against the
+# framing described at serve() in c/src/dao.c: 'O' frames of output, an 'S' frame of six
+# numbers once the job has run, and a last 'X' frame with the status of dao_run().
+
+import os, socket, struct, sys
+
+DAO_SOURCE, DAO_DONE, DAO_PAUSED, DAO_ERROR = 0, 0, 1, -1
+SERVE_STREAM = 0xFFFFFFFF
+
+path, tests = sys.argv[1], sys.argv[2]
+failed = 0
+
+def read(name):
+    with open(os.path.join(tests, name), 'rb') as f:
+        return f.read()
+
+def take(reply, count):
+    data = b''
+    while len(data) < count:
+        part = reply.read(count - len(data))
+        if not part:
+            raise EOFError('the server closed the connection')
+        data += part
+    return data
+
+def header(kind, program, given, budget=0):
+    return struct.pack('>cBIIQ', kind, DAO_SOURCE, len(program), given, budget) + program
+
+def answer(reply):
+    out, stats = b'', None
+    while True:
+        kind, length = struct.unpack('>cI', take(reply, 5))
+        data = take(reply, length)
+        if kind == b'O' and stats is None:
+            out += data
+        elif kind == b'S' and stats is None and length == 48:
+            stats = struct.unpack('>6Q', data)
+        elif kind == b'X' and length == 4:
+            return out, stats, struct.unpack('>i', data)[0]
+        else:
+            raise ValueError('unexpected %r frame of %d bytes' % (kind, length))
+
+def check(name, got, want):
+    global failed
+    if got != want:
+        print('FAIL serve %s: got %r, wanted %r' % (name, got, want))
+        failed += 1
+
+conn = socket.socket(socket.AF_UNIX)
+conn.connect(path)
+reply = conn.makefile('rb')
+
+# A program sent whole, with no INPUT
+conn.sendall(header(b'B', read('hello_world.dao'), 0))
+out, stats, status = answer(reply)
+check('hello_world', (out, status, stats is not None and stats[0] >= 1), (read('hello_world.expected'), DAO_DONE, True))
+
+# A program file named, with its INPUT after it
+given = read('bigswap.input')
+conn.sendall(header(b'F', os.path.abspath(os.path.join(tests, 'bigswap.dao')).encode(), len(given)) + given)
+out, stats, status = answer(reply)
+check('bigswap', (out, status), (read('bigswap.expected'), DAO_DONE))
+
+# INPUT streamed in frames, a byte of the program's first INPUT and then the rest, up to an empty frame
+conn.sendall(header(b'B', read('cateof.dao'), SERVE_STREAM))
+given = read('cateof.input')
+for frame in (given[:1], given[1:4], given[4:], b''):
+    conn.sendall(struct.pack('>I', len(frame)) + frame)
+out, stats, status = answer(reply)
+check('cateof', (out, status), (read('cateof.expected'), DAO_DONE))
+
+# A budget that runs out first
+conn.sendall(header(b'B', read('memo.dao'), 0, 3))
+out, stats, status = answer(reply)
+check('budget', (status, stats is not None and stats[1]), (DAO_PAUSED, 3))
+
+# A file that is not there: no statistics, as nothing ran
+conn.sendall(header(b'F', os.path.join(tests, 'nonesuch.dao').encode(), 0))
+out, stats, status = answer(reply)
+check('nonesuch', (out, stats, status), (b'', None, DAO_ERROR))
+
+conn.close()
+print('serve: %d failed' % failed)
+sys.exit(1 if failed else 0)